@@ -0,0 +1,12 @@
+function data = load_capture(name)
+%LOAD_CAPTURE Loads a node export, given its path without extension.
+%   Prefers the columnar export (NAME.col), falling back to CSV (NAME.csv).
+%
+%   Author: João Borrego
+
+    if exist([char(name) '.col'], 'file')
+        data = read_columns([char(name) '.col']);
+    else
+        data = csvread([char(name) '.csv']);
+    end
+end
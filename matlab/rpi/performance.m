@@ -6,8 +6,8 @@ args = {'interpreter','latex','FontSize',26};
 
 %% a) Distributed Control
 
-data_0 = csvread("data/a_0.csv");
-data_1 = csvread("data/a_1.csv");
+data_0 = load_capture("data/a_0");
+data_1 = load_capture("data/a_1");
 
 time_0 = data_0(:,1) / 1000.0; 
 lux_0  = data_0(:,2);
@@ -55,8 +55,8 @@ print(fig,'-dpdf','-r300',char(output_name));
 
 %% b) Non-distributed Control
 
-data_0 = csvread("data/b_0.csv");
-data_1 = csvread("data/b_1.csv");
+data_0 = load_capture("data/b_0");
+data_1 = load_capture("data/b_1");
 
 time_0 = data_0(:,1) / 1000.0; 
 lux_0  = data_0(:,2);
@@ -0,0 +1,46 @@
+function [data, names] = read_columns(filename)
+%READ_COLUMNS Reads a node export in the server's columnar format.
+%   DATA = READ_COLUMNS(FILENAME) returns the exported columns as a matrix,
+%   in the same order as the CSV export (timestamp, lux, duty cycle, lux
+%   reference, comfort error, comfort variance), so it may replace csvread.
+%   [DATA, NAMES] = READ_COLUMNS(FILENAME) also returns the column names.
+%
+%   Files hold a header followed by each column's values contiguously, so
+%   every column is loaded with a single fread.
+%
+%   Author: João Borrego
+
+    % Column types, as in the journal schema
+    types = {'uint8', 'uint16', 'uint32', 'uint64', 'single', 'double'};
+
+    fid = fopen(filename, 'r', 'ieee-le');
+    if fid == -1
+        error('read_columns:open', 'Could not open %s', filename);
+    end
+    cleanup = onCleanup(@() fclose(fid));
+
+    magic = fread(fid, 8, '*char')';
+    version = fread(fid, 1, 'uint32');
+    if ~strcmp(magic, 'SCDTRCOL') || version ~= 1
+        error('read_columns:format', '%s is not a columnar export', filename);
+    end
+    fread(fid, 1, 'uint32');                % header size
+    columns = fread(fid, 1, 'uint32');
+    fread(fid, 1, 'uint32');                % reserved
+    rows = fread(fid, 1, 'uint64');
+
+    names = cell(1, columns);
+    type = zeros(1, columns);
+    offset = zeros(1, columns);
+    for i = 1:columns
+        names{i} = deblank(char(fread(fid, 20, 'uint8')'));
+        type(i) = fread(fid, 1, 'uint32');
+        offset(i) = fread(fid, 1, 'uint64');
+    end
+
+    data = zeros(rows, columns);
+    for i = 1:columns
+        fseek(fid, offset(i), 'bof');
+        data(:, i) = double(fread(fid, rows, ['*' types{type(i) + 1}]));
+    end
+end
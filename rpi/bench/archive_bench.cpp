@@ -0,0 +1,130 @@
+/**
+ * @file    rpi/bench/archive_bench.cpp
+ *
+ * @brief   Cold log compression benchmark
+ *
+ * Compresses captured log traces (CSV files written by the S command) into
+ * archive blocks, and reports the compression ratio with respect to the
+ * 28-byte uncompressed entry fields and to the 10-byte hot history columns,
+ * and the decode throughput.
+ *
+ * Usage: archive_bench.bin [trace.csv ...], from the rpi directory by
+ * default on the matlab/rpi/data traces.
+ *
+ * @author  João Borrego
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <climits>
+
+#include "../src/constants.hpp"
+#include "../src/Archive.hpp"
+
+/** Bytes per uncompressed entry (timestamp and five floats) */
+const double RAW_BYTES = sizeof(unsigned long) + 5 * sizeof(float);
+/** Bytes per hot history entry (timestamp offset and quantised columns) */
+const double HOT_BYTES = sizeof(uint32_t) + History::COLUMNS * sizeof(uint16_t);
+/** Minimum number of entries decoded per measurement */
+const size_t DECODED = 10000000;
+
+/**
+ * @brief      Loads a trace.
+ *
+ * @param[in]  path     The CSV file path
+ * @param      entries  The output entries
+ *
+ * @return     True on success, false otherwise.
+ */
+bool load(const std::string & path, std::vector< Entry > & entries)
+{
+    std::ifstream input(path.c_str());
+    if (!input.is_open()) return false;
+
+    std::string line;
+    while (std::getline(input, line))
+    {
+        std::istringstream iss(line);
+        Entry e;
+        char c;
+        if (iss >> e.timestamp >> c >> e.lux >> c >> e.duty_cycle >> c
+            >> e.lux_reference >> c >> e.c_err >> c >> e.c_var)
+        {
+            entries.push_back(e);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief      Benchmark main application.
+ *
+ * @param[in]  argc  The argc
+ * @param      argv  The argv
+ *
+ * @return     0 on success, EXIT_FAILURE otherwise.
+ */
+int main(int argc, char *argv[])
+{
+    std::vector< std::string > paths(argv + 1, argv + argc);
+    if (paths.empty())
+    {
+        for (const char *name : {"a_0", "a_1", "b_0", "b_1"})
+        {
+            paths.push_back(std::string("../matlab/rpi/data/") + name + ".csv");
+        }
+    }
+
+    std::cout << std::left << std::setw(36) << "trace" << std::right
+        << std::setw(10) << "entries" << std::setw(12) << "bits/entry"
+        << std::setw(10) << "raw ratio" << std::setw(10) << "hot ratio"
+        << std::setw(14) << "decode Me/s"
+        << std::endl;
+
+    for (const std::string & path : paths)
+    {
+        std::vector< Entry > entries;
+        if (!load(path, entries) || entries.empty())
+        {
+            std::cerr << "Could not read " << path << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        // The archive keeps everything, as a node would beyond its hot window
+        Archive archive(entries.size(), T_S);
+        Metrics metrics;
+        for (const Entry & e : entries)
+        {
+            archive.push_back(e, metrics);
+            metrics.update(e.timestamp, e.lux, e.duty_cycle, e.lux_reference);
+        }
+
+        volatile double sink = 0;
+        size_t decoded = 0;
+        auto start = std::chrono::steady_clock::now();
+        while (decoded < DECODED)
+        {
+            archive.forEachEntry(0, ULONG_MAX,
+                [&](const Entry & e){ sink = sink + e.lux; });
+            decoded += entries.size();
+        }
+        double elapsed = std::chrono::duration< double >(
+            std::chrono::steady_clock::now() - start).count();
+
+        double bits = 8.0 * archive.bytes() / entries.size();
+        std::cout << std::left << std::setw(36) << path << std::right
+            << std::fixed << std::setprecision(2)
+            << std::setw(10) << entries.size()
+            << std::setw(12) << bits
+            << std::setw(9) << RAW_BYTES * 8 / bits << "x"
+            << std::setw(9) << HOT_BYTES * 8 / bits << "x"
+            << std::setw(14) << decoded / elapsed / 1e6
+            << std::endl;
+    }
+    return 0;
+}
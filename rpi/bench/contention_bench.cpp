@@ -0,0 +1,175 @@
+/**
+ * @file    rpi/bench/contention_bench.cpp
+ *
+ * @brief   Latest-value read contention benchmark
+ *
+ * Runs a number of reader threads, standing in for TCP sessions polling
+ * 'g l (i)', against a single writer inserting entries at 1 kHz.
+ * Compares the former shared_mutex-protected getters with the System's
+ * sequence-locked node state.
+ *
+ * @author  João Borrego
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include "../src/System.hpp"
+
+/** Number of nodes */
+const size_t BENCH_NODES = 2;
+/** Duration of each measurement (ms) */
+const int DURATION = 1000;
+/** Writer period (us) */
+const int WRITER_PERIOD = 1000;
+
+/**
+ * @brief      Former getter implementation, guarded by a shared mutex.
+ */
+class LockedStore
+{
+
+public:
+
+    /** Mutex shared by readers and the writer */
+    boost::shared_mutex mutex;
+    /** Node histories */
+    std::vector< History > entries;
+
+    /**
+     * @brief      Constructs the store.
+     */
+    LockedStore() : entries(BENCH_NODES, History(HISTORY_CAPACITY, T_S)) {}
+
+    /**
+     * @brief      Inserts an entry.
+     *
+     * @param[in]  id     The node identifier
+     * @param[in]  entry  The entry
+     */
+    void insert(size_t id, const Entry & entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(mutex);
+        entries.at(id).push_back(entry);
+    }
+
+    /**
+     * @brief      Gets the latest lux value.
+     *
+     * @param[in]  id    The node identifier
+     *
+     * @return     The lux.
+     */
+    float getLux(size_t id)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mutex);
+        History & h = entries.at(id);
+        return (h.empty())? -1 : h.value(History::COL_LUX, h.size() - 1);
+    }
+};
+
+/**
+ * @brief      Runs readers against a 1 kHz writer.
+ *
+ * @param[in]  readers  The number of reader threads
+ * @param[in]  insert   The writer operation, called as insert(id, entry)
+ * @param[in]  read     The reader operation, called as read(id)
+ * @param      max_us   The worst writer insertion latency (us)
+ *
+ * @tparam     I        The writer operation type
+ * @tparam     R        The reader operation type
+ *
+ * @return     Total reads per second.
+ */
+template < typename I, typename R >
+double run(int readers, I insert, R read, double & max_us)
+{
+    std::atomic< bool > stop(false);
+    std::vector< unsigned long > counts(readers * 16, 0);
+    std::vector< std::thread > threads;
+    volatile float sink = 0;
+
+    for (int r = 0; r < readers; r++)
+    {
+        threads.emplace_back([&, r]{
+            unsigned long n = 0;
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                sink = read(n % BENCH_NODES);
+                n++;
+            }
+            counts[r * 16] = n;
+        });
+    }
+
+    max_us = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto next = start;
+    unsigned long t = 0;
+    while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(DURATION))
+    {
+        for (size_t id = 0; id < BENCH_NODES; id++)
+        {
+            auto before = std::chrono::steady_clock::now();
+            insert(id, Entry(t, 30.0, 0.5, 33.3, 0, 0));
+            auto after = std::chrono::steady_clock::now();
+            max_us = std::max(max_us,
+                std::chrono::duration< double, std::micro >(after - before).count());
+        }
+        t++;
+        next += std::chrono::microseconds(WRITER_PERIOD);
+        std::this_thread::sleep_until(next);
+    }
+    stop = true;
+    for (auto & th : threads) th.join();
+    // A starved writer may overrun the nominal duration
+    double elapsed = std::chrono::duration< double >(
+        std::chrono::steady_clock::now() - start).count();
+
+    unsigned long total = 0;
+    for (int r = 0; r < readers; r++) total += counts[r * 16];
+    return total / elapsed;
+}
+
+/**
+ * @brief      Benchmark main application.
+ *
+ * @return     0 on success.
+ */
+int main()
+{
+    std::cout << std::setw(8) << "readers"
+        << std::setw(16) << "mutex reads/s" << std::setw(16) << "mutex max us"
+        << std::setw(18) << "seqlock reads/s" << std::setw(16) << "seqlock max us"
+        << std::endl;
+
+    for (int readers : {1, 2, 4, 8})
+    {
+        double locked_max, seqlock_max;
+
+        LockedStore locked;
+        double locked_reads = run(readers,
+            [&](size_t id, const Entry & e){ locked.insert(id, e); },
+            [&](size_t id){ return locked.getLux(id); },
+            locked_max);
+
+        System system(BENCH_NODES, T_S, HISTORY_CAPACITY, HISTORY_RETENTION);
+        double seqlock_reads = run(readers,
+            [&](size_t id, const Entry & e){
+                system.insertEntry(id, e.timestamp, e.lux, e.duty_cycle, e.lux_reference); },
+            [&](size_t id){ return system.getLux(id); },
+            seqlock_max);
+
+        std::cout << std::fixed << std::setprecision(0)
+            << std::setw(8) << readers
+            << std::setw(16) << locked_reads << std::setw(16) << locked_max
+            << std::setw(18) << seqlock_reads << std::setw(16) << seqlock_max
+            << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,162 @@
+/**
+ * @file    rpi/bench/history_bench.cpp
+ *
+ * @brief   Log entry layout microbenchmark
+ *
+ * Compares the former array-of-structs entry log (std::vector< Entry >)
+ * with the columnar History store, for the scans the server performs:
+ * column reductions, timestamp range selection and filtered queries.
+ *
+ * @author  João Borrego
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#include "../src/constants.hpp"
+#include "../src/History.hpp"
+#include "../src/Query.hpp"
+
+/** Number of entries (roughly 28 hours at 10 Hz) */
+const size_t ENTRIES = 1000000;
+/** Number of repetitions per measurement */
+const int REPEATS = 50;
+
+/** Prevents the compiler from discarding benchmark results */
+volatile double sink;
+
+/**
+ * @brief      Times a function, averaged over REPEATS runs.
+ *
+ * @param[in]  f     The function
+ *
+ * @tparam     F     The function type
+ *
+ * @return     Nanoseconds per entry.
+ */
+template < typename F >
+double timeIt(F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < REPEATS; r++) sink = f();
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration< double, std::nano >(end - start).count();
+    return ns / (REPEATS * (double) ENTRIES);
+}
+
+/**
+ * @brief      Prints a result row.
+ *
+ * @param[in]  name  The benchmark name
+ * @param[in]  aos   The array-of-structs time (ns/entry)
+ * @param[in]  soa   The columnar time (ns/entry)
+ */
+void report(const std::string & name, double aos, double soa)
+{
+    std::cout << std::left << std::setw(20) << name << std::right << std::fixed
+        << std::setprecision(3)
+        << std::setw(12) << aos
+        << std::setw(12) << soa
+        << std::setw(10) << std::setprecision(2) << aos / soa << "x" << std::endl;
+}
+
+/**
+ * @brief      Benchmark main application.
+ *
+ * @return     0 on success.
+ */
+int main()
+{
+    std::mt19937 rng(42);
+    std::uniform_real_distribution< float > noise(-1.0, 1.0);
+
+    std::vector< Entry > aos;
+    aos.reserve(ENTRIES);
+    History soa(ENTRIES, T_S);
+
+    for (size_t i = 0; i < ENTRIES; i++)
+    {
+        Entry e(i * 100, 30 + noise(rng), 0.5 + 0.1 * noise(rng), 33.3, 0, 0,
+            (i / 600) % 2);
+        aos.push_back(e);
+        soa.push_back(e);
+    }
+
+    // Select the middle half of the log
+    unsigned long start = ENTRIES / 4 * 100;
+    unsigned long end = 3 * ENTRIES / 4 * 100;
+
+    std::cout << std::left << std::setw(20) << "ns/entry" << std::right
+        << std::setw(12) << "AoS" << std::setw(12) << "columnar"
+        << std::setw(11) << "speedup" << std::endl;
+
+    report("sum lux",
+        timeIt([&]{
+            double total = 0.0;
+            for (auto & e : aos) total += e.lux;
+            return total; }),
+        timeIt([&]{ return soa.sum(History::COL_LUX, 0, soa.size()); }));
+
+    report("min lux",
+        timeIt([&]{
+            float m = aos[0].lux;
+            for (auto & e : aos) m = std::min(m, e.lux);
+            return (double) m; }),
+        timeIt([&]{ return (double) soa.min(History::COL_LUX, 0, soa.size()); }));
+
+    report("max duty cycle",
+        timeIt([&]{
+            float m = aos[0].duty_cycle;
+            for (auto & e : aos) m = std::max(m, e.duty_cycle);
+            return (double) m; }),
+        timeIt([&]{ return (double) soa.max(History::COL_DUTY_CYCLE, 0, soa.size()); }));
+
+    report("range sum lux",
+        timeIt([&]{
+            double total = 0.0;
+            for (auto & e : aos)
+                if (e.timestamp >= start && e.timestamp <= end) total += e.lux;
+            return total; }),
+        timeIt([&]{
+            size_t first = soa.lowerBound(start);
+            size_t last = soa.upperBound(end);
+            return soa.sum(History::COL_LUX, first, last); }));
+
+    // Occupied mean lux below 30.5 lx, per minute, over the middle half
+    Query query;
+    query.aggregate = Query::AGG_AVG;
+    query.column = History::COL_LUX;
+    query.start = start;
+    query.end = end;
+    query.bucket = 60 * 1000;
+    query.conditions.push_back(Query::compare(History::COL_OCCUPANCY,
+        Query::OP_EQUAL, 1));
+    query.conditions.push_back(Query::compare(History::COL_LUX,
+        Query::OP_LESS, 30.5));
+    Archive archive;
+    std::vector< QueryBucket > buckets;
+
+    report("query lux by min",
+        timeIt([&]{
+            std::vector< double > sums(query.buckets(), 0.0);
+            std::vector< size_t > counts(query.buckets(), 0);
+            for (auto & e : aos)
+            {
+                if (e.timestamp < start || e.timestamp > end) continue;
+                if (!e.occupancy || e.lux >= 30.5f) continue;
+                size_t k = (e.timestamp - start) / query.bucket;
+                sums[k] += e.lux;
+                counts[k]++;
+            }
+            return sums[0] / counts[0]; }),
+        timeIt([&]{
+            buckets.assign(query.buckets(), QueryBucket());
+            query.scan(soa, archive, buckets);
+            return query.value(buckets[0]); }));
+
+    return 0;
+}
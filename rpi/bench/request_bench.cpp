@@ -0,0 +1,280 @@
+/**
+ * @file    rpi/bench/request_bench.cpp
+ *
+ * @brief   Request dispatch benchmark
+ *
+ * Answers a mix of common requests, as a session does, with the general
+ * stream-based parser and with the in-place dispatch into a reused response
+ * buffer. Reports requests per second and heap allocations per request.
+ *
+ * Replies are first checked for every request type and parameter, on a
+ * system with a node yet to report: get replies against a reference built
+ * from the System getters, as the text protocol formats them, and the others
+ * against the general parser. Exits with failure on a mismatch.
+ *
+ * @author  João Borrego
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+
+#include "../src/request.hpp"
+
+/** Number of nodes */
+const size_t BENCH_NODES = 2;
+/** Requests answered per measurement */
+const size_t REQUESTS = 1000000;
+
+/** Heap allocations so far */
+static std::atomic< unsigned long > allocations(0);
+
+/*
+ * Replaced allocation functions, counting allocations. Kept out of line, so
+ * that the compiler pairs each delete with its new rather than with malloc.
+ */
+
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+/**
+ * @brief      Formats the reference reply to a get request.
+ *
+ * @param      system  The system
+ * @param[in]  param   The parameter
+ * @param[in]  node    The node identifier, -1 for the total
+ * @param[in]  window  The window (ms), 0 since restart
+ *
+ * @return     The reply, empty if the request is invalid.
+ */
+std::string referenceGet(System & system, char param, int node, unsigned long window)
+{
+    bool total = (node < 0);
+    bool accumulated = (param == ENERGY || param == COMFORT_ERR || param == COMFORT_VAR);
+    if ((total && param != POWER && !accumulated) || (window && !accumulated))
+    {
+        return "";
+    }
+    std::string value;
+    switch (param)
+    {
+        case LUX:          value = std::to_string(system.getLux(node));            break;
+        case DUTY_CYCLE:   value = std::to_string(system.getDutyCycle(node));      break;
+        case OCCUPANCY:    value = std::to_string(system.getOccupancy(node));      break;
+        case LUX_LOWER:    value = std::to_string(system.getLuxLowerBound(node));  break;
+        case LUX_EXTERNAL: value = std::to_string(system.getLuxExternal(node));    break;
+        case LUX_REF:      value = std::to_string(system.getLuxReference(node));   break;
+        case POWER:        value = std::to_string(system.getPower(node, total));   break;
+        case ENERGY:
+            value = std::to_string(system.getEnergy(node, total, window));
+            break;
+        case COMFORT_ERR:
+            value = std::to_string(system.getComfortError(node, total, window));
+            break;
+        case COMFORT_VAR:
+            value = std::to_string(system.getComfortVariance(node, total, window));
+            break;
+        case TIMESTAMP:
+        {
+            long timestamp = system.getTimestamp(node);
+            value = std::to_string((float) timestamp / 1000.0);
+            break;
+        }
+        default:
+            return "";
+    }
+    return std::string(1, param) + " "
+        + ((total)? std::string(1, TOTAL) : std::to_string(node)) + " " + value;
+}
+
+/**
+ * @brief      Checks the replies to every request type and parameter.
+ *
+ * @param[in]  system  The system, whose last node has no samples
+ *
+ * @return     The number of mismatches.
+ */
+size_t check(System::ptr system)
+{
+    std::vector< unsigned long > timestamps(system->getNodes());
+    std::vector< bool > parse_flags(STREAM_FLAGS * system->getNodes());
+    std::vector< bool > dispatch_flags(parse_flags);
+    ExportJob::ptr job;
+    size_t mismatches = 0;
+
+    const std::string params = "ldoLOrpecvtx";
+    std::vector< std::string > nodes = {"T", "-1", "a"};
+    for (size_t id = 0; id <= system->getNodes(); id++)
+    {
+        nodes.push_back(std::to_string(id));
+    }
+
+    for (const char *type : {GET, SET, START_STREAM, STOP_STREAM, QUANTILES, "x"})
+    {
+        for (char param : params)
+        {
+            for (const std::string & node : nodes)
+            {
+                for (const char *window : {"", " 60", " .", " 1e3", " -5", " x"})
+                {
+                    std::string request = std::string(type) + " " + param + " "
+                        + node + window;
+
+                    std::string parsed, dispatched;
+                    parseRequest(system, timestamps, parse_flags, job, request, parsed);
+                    dispatchRequest(system, timestamps, dispatch_flags, job,
+                        boost::string_view(request), dispatched);
+
+                    std::string expected = parsed;
+                    if (std::string(type) == GET)
+                    {
+                        int id = -1;
+                        bool valid = (node == "T");
+                        if (!valid && node.find_first_not_of("0123456789") == std::string::npos)
+                        {
+                            id = std::stoi(node);
+                            valid = (id < (int) system->getNodes());
+                        }
+                        // Only the well-formed window is valid
+                        unsigned long w = (*window)? 60000 : 0;
+                        valid = valid && (!*window || std::string(window) == " 60");
+                        expected = (valid)? referenceGet(*system, param, id, w) : "";
+                        if (expected.empty()) expected = INVALID;
+                    }
+
+                    if (parsed != expected || dispatched != expected ||
+                        parse_flags != dispatch_flags)
+                    {
+                        std::cerr << "Mismatch for '" << request << "': expected '"
+                            << expected << "', parsed '" << parsed
+                            << "', dispatched '" << dispatched << "'" << std::endl;
+                        mismatches++;
+                    }
+                }
+            }
+        }
+    }
+    return mismatches;
+}
+
+/**
+ * @brief      Answers the requests repeatedly.
+ *
+ * @param[in]  requests  The requests
+ * @param[in]  handle    The handler, called as handle(request)
+ * @param      per_request  The heap allocations per request
+ *
+ * @tparam     H         The handler type
+ *
+ * @return     Requests per second.
+ */
+template < typename H >
+double run(const std::vector< std::string > & requests, H handle, double & per_request)
+{
+    unsigned long before = allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < REQUESTS; i++)
+    {
+        handle(requests[i % requests.size()]);
+    }
+    double elapsed = std::chrono::duration< double >(
+        std::chrono::steady_clock::now() - start).count();
+    per_request = (double) (allocations.load() - before) / REQUESTS;
+    return REQUESTS / elapsed;
+}
+
+/**
+ * @brief      Benchmark main application.
+ *
+ * @return     0 on success.
+ */
+int main()
+{
+    // The last node has yet to report
+    System::ptr system(new System(BENCH_NODES + 1, T_S, HISTORY_CAPACITY, HISTORY_RETENTION));
+    for (unsigned long t = 0; t < 10000; t += 10)
+    {
+        for (size_t id = 0; id < BENCH_NODES; id++)
+        {
+            system->insertEntry(id, t, 30.0 + id, 0.5, 33.3);
+        }
+    }
+
+    size_t mismatches = check(system);
+    if (mismatches)
+    {
+        std::cerr << mismatches << " replies differ from the reference" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector< unsigned long > timestamps(system->getNodes());
+    std::vector< bool > flags(STREAM_FLAGS * system->getNodes());
+    ExportJob::ptr job;
+    std::vector< std::string > requests = {
+        "g l 0", "g d 1", "g o 0", "g r 1", "g p T", "g e 0",
+        "g c T", "g v 1", "g e T 5", "g t 0", "g L 1", "g p 0"};
+
+    // Former session path: a request string and a response string each
+    double parse_allocations;
+    double parse_rate = run(requests, [&](const std::string & r){
+            std::string request(r.data(), r.size());
+            std::string response;
+            parseRequest(system, timestamps, flags, job, request, response);
+            response += MSG_DELIMETER;
+        }, parse_allocations);
+
+    // Session path: responses appended to the reused output buffer
+    std::string output;
+    output.reserve(SEND_BUFFER);
+    double dispatch_allocations;
+    double dispatch_rate = run(requests, [&](const std::string & r){
+            if (output.size() > SEND_BUFFER / 2) output.clear();
+            dispatchRequest(system, timestamps, flags, job,
+                boost::string_view(r.data(), r.size()), output);
+            output += MSG_DELIMETER;
+        }, dispatch_allocations);
+
+    std::cout << std::setw(12) << "path" << std::setw(16) << "requests/s"
+        << std::setw(20) << "allocations/request" << std::endl;
+    std::cout << std::fixed
+        << std::setw(12) << "parse" << std::setw(16) << std::setprecision(0) << parse_rate
+        << std::setw(20) << std::setprecision(2) << parse_allocations << std::endl
+        << std::setw(12) << "dispatch" << std::setw(16) << std::setprecision(0) << dispatch_rate
+        << std::setw(20) << std::setprecision(2) << dispatch_allocations << std::endl;
+    return 0;
+}
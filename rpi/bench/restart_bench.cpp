@@ -0,0 +1,214 @@
+/**
+ * @file    rpi/bench/restart_bench.cpp
+ *
+ * @brief   Warm restart benchmark
+ *
+ * Ingests a session of samples from every node at T_S into a live system,
+ * journaling them as the commit stage does, then measures how long another
+ * system takes to restore it on opening the journal, as the server does at
+ * startup.
+ *
+ * The restored system is then checked against the live one: accumulated
+ * metrics per node and in total, windowed metrics and quantiles. Exits with
+ * failure on any mismatch.
+ *
+ * Usage: restart_bench.bin [hours] [nodes] [journal], by default 24 hours
+ * of NODES nodes.
+ *
+ * @author  João Borrego
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <unistd.h>
+
+#include "../src/System.hpp"
+#include "../src/request.hpp"
+
+/** Relative tolerance of totals, summed from per-node changes in any order */
+const double TOTAL_TOLERANCE = 1e-6;
+
+/**
+ * @brief      Class for the comparison of two systems.
+ */
+class Comparison
+{
+
+public:
+
+    /** Values compared */
+    size_t compared;
+    /** Values that differ */
+    size_t mismatches;
+
+    /**
+     * @brief      Constructs an empty comparison.
+     */
+    Comparison() : compared(0), mismatches(0) {}
+
+    /**
+     * @brief      Compares a value, reporting a mismatch.
+     *
+     * @param[in]  what       The value description
+     * @param[in]  expected   The live value
+     * @param[in]  actual     The restored value
+     * @param[in]  tolerance  The relative tolerance, 0 for exact
+     */
+    void check(const std::string & what, double expected, double actual,
+        double tolerance = 0)
+    {
+        compared++;
+        if (std::abs(expected - actual) <= tolerance * std::max(1.0, std::abs(expected)))
+        {
+            return;
+        }
+        mismatches++;
+        std::cerr << std::setprecision(9) << what << ": live " << expected
+            << ", restored " << actual << std::endl;
+    }
+};
+
+/**
+ * @brief      Benchmark main application.
+ *
+ * @param[in]  argc  The argc
+ * @param      argv  The argv
+ *
+ * @return     0 on success, EXIT_FAILURE otherwise.
+ */
+int main(int argc, char *argv[])
+{
+    double hours = (argc > 1)? std::stod(argv[1]) : 24;
+    size_t nodes = (argc > 2)? std::stoul(argv[2]) : NODES;
+    std::string path = (argc > 3)? argv[3] : "restart_bench.jnl";
+
+    // The session ends now, so windows up to now cover its latest samples
+    size_t steps = (size_t) (hours * 3600 / T_S);
+    unsigned long duration = (unsigned long) (steps * T_S * 1000);
+    unsigned long now = std::chrono::duration_cast< std::chrono::milliseconds >(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    unlink(path.c_str());
+    {
+        Journal journal;
+        if (!journal.open(path, nodes, T_S))
+        {
+            return EXIT_FAILURE;
+        }
+        journal.appendReset(now - duration);
+    }
+
+    // Resuming the empty session sets the live system's time reference,
+    // then samples are ingested and journaled as the commit stage would
+    System live(nodes, T_S, HISTORY_CAPACITY, HISTORY_RETENTION);
+    if (!live.openJournal(path))
+    {
+        return EXIT_FAILURE;
+    }
+    std::vector< Sample > batch;
+    for (size_t k = 0; k < steps; k++)
+    {
+        for (size_t id = 0; id < nodes; id++)
+        {
+            batch.emplace_back();
+            Sample & sample = batch.back();
+            sample.id = id;
+            sample.timestamp = (unsigned long) (k * T_S * 1000);
+            sample.occupancy = (k / 600 + id) % 2;
+            sample.lux = 30.0 + 5.0 * std::sin(k * 1e-3 + id);
+            sample.duty_cycle = 0.5 + 0.1 * std::cos(k * 1e-3);
+            sample.lux_reference = (sample.occupancy)? 50.0 : 33.3;
+            sample.lux_lower_bound = 30.0;
+            sample.lux_external = 5.0;
+            if (batch.size() == COMMIT_BATCH)
+            {
+                live.insertEntries(batch.data(), batch.size());
+                batch.clear();
+            }
+        }
+    }
+    live.insertEntries(batch.data(), batch.size());
+
+    auto start = std::chrono::steady_clock::now();
+    System restored(nodes, T_S, HISTORY_CAPACITY, HISTORY_RETENTION);
+    if (!restored.openJournal(path))
+    {
+        return EXIT_FAILURE;
+    }
+    double elapsed = std::chrono::duration< double >(
+        std::chrono::steady_clock::now() - start).count();
+
+    std::cout << std::fixed << std::setprecision(3)
+        << "restored " << steps * nodes << " samples (" << hours << " h, "
+        << nodes << " nodes) in " << elapsed << " s, "
+        << std::setprecision(2) << steps * nodes / elapsed / 1e6 << " M/s"
+        << std::endl;
+
+    // Windows start halfway between samples, so that the start does not
+    // cross a sample while both systems are queried
+    auto window = [&](double seconds) -> unsigned long {
+        double begin = duration - seconds * 1000 + T_S * 1000 / 2;
+        unsigned long since_reset = live.millis();
+        return (begin > 0)? since_reset - (unsigned long) begin : since_reset + 1;
+    };
+
+    Comparison c;
+    const std::vector< double > windows = {1, 60, 3600, hours * 3600 + 3600};
+    const std::vector< double > quantiles = {0.5, 0.95, 0.99};
+    for (size_t k = 0; k <= nodes; k++)
+    {
+        // Every node, then the totals
+        bool total = (k == nodes);
+        size_t id = (total)? 0 : k;
+        std::string node = (total)? std::string(1, TOTAL) : std::to_string(id);
+
+        c.check("p " + node, live.getPower(id, total), restored.getPower(id, total),
+            (total)? TOTAL_TOLERANCE : 0);
+        c.check("e " + node, live.getEnergy(id, total), restored.getEnergy(id, total),
+            (total)? TOTAL_TOLERANCE : 0);
+        c.check("c " + node, live.getComfortError(id, total),
+            restored.getComfortError(id, total), (total)? TOTAL_TOLERANCE : 0);
+        c.check("v " + node, live.getComfortVariance(id, total),
+            restored.getComfortVariance(id, total), (total)? TOTAL_TOLERANCE : 0);
+        if (!total)
+        {
+            c.check("t " + node, live.getTimestamp(id), restored.getTimestamp(id));
+        }
+
+        for (double seconds : windows)
+        {
+            std::string w = node + " " + std::to_string((long) seconds);
+            unsigned long ms = window(seconds);
+            c.check("e " + w, live.getEnergy(id, total, ms),
+                restored.getEnergy(id, total, ms));
+            ms = window(seconds);
+            c.check("c " + w, live.getComfortError(id, total, ms),
+                restored.getComfortError(id, total, ms));
+            ms = window(seconds);
+            c.check("v " + w, live.getComfortVariance(id, total, ms),
+                restored.getComfortVariance(id, total, ms));
+        }
+
+        for (char var : {COMFORT_ERR, DUTY_CYCLE})
+        {
+            std::vector< double > expected, actual;
+            live.getQuantiles(id, total, var, quantiles, expected);
+            restored.getQuantiles(id, total, var, quantiles, actual);
+            for (size_t i = 0; i < quantiles.size(); i++)
+            {
+                c.check(std::string("q ") + var + " " + node + " "
+                    + std::to_string(quantiles[i]), expected[i], actual[i]);
+            }
+        }
+    }
+
+    std::cout << "compared " << c.compared << " values with the live system, "
+        << c.mismatches << " mismatches" << std::endl;
+
+    unlink(path.c_str());
+    return (c.mismatches)? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,128 @@
+/**
+ * @file    rpi/bench/scaling_bench.cpp
+ *
+ * @brief   Node count scaling benchmark
+ *
+ * Runs a writer committing batches of samples round-robin over every node,
+ * as the commit stage does, against reader threads standing in for TCP
+ * sessions issuing 'b' queries on random nodes. Reports ingest and query
+ * throughput as the number of nodes grows.
+ *
+ * @author  João Borrego
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+
+#include "../src/System.hpp"
+
+/** Number of reader threads */
+const int READERS = 4;
+/** Duration of each measurement (ms) */
+const int DURATION = 1000;
+/** Raw entries kept per node */
+const size_t CAPACITY = 6000;
+/** Length of the period requested by readers (ms) */
+const unsigned long QUERY_PERIOD = 1000;
+
+/**
+ * @brief      Runs the writer and readers against a system.
+ *
+ * @param[in]  nodes    The number of nodes
+ * @param      ingest   The output samples inserted per second
+ * @param      queries  The output queries answered per second
+ */
+void run(size_t nodes, double & ingest, double & queries)
+{
+    System system(nodes, T_S, CAPACITY, HISTORY_RETENTION);
+    std::atomic< bool > stop(false);
+    std::atomic< unsigned long > now(0);
+    std::vector< unsigned long > counts(READERS * 16, 0);
+    std::vector< std::thread > threads;
+
+    for (int r = 0; r < READERS; r++)
+    {
+        threads.emplace_back([&, r]{
+            std::mt19937 gen(r);
+            std::uniform_int_distribution< size_t > node(0, nodes - 1);
+            std::string response;
+            unsigned long n = 0;
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                unsigned long t = now.load(std::memory_order_relaxed);
+                unsigned long start = (t > QUERY_PERIOD)? t - QUERY_PERIOD : 0;
+                system.getValuesInPeriod(node(gen), start, t, 'l', response);
+                n++;
+            }
+            counts[r * 16] = n;
+        });
+    }
+
+    // Samples arrive interleaved over nodes, 100 ms of simulated time apart
+    std::vector< Sample > batch(COMMIT_BATCH);
+    unsigned long inserted = 0;
+    unsigned long t = 0;
+    size_t id = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(DURATION))
+    {
+        for (auto & sample : batch)
+        {
+            sample.id = id;
+            sample.timestamp = t;
+            sample.lux = 30.0;
+            sample.duty_cycle = 0.5;
+            sample.lux_reference = 33.3;
+            sample.lux_lower_bound = 30.0;
+            sample.lux_external = 5.0;
+            sample.occupancy = true;
+            if (++id == nodes)
+            {
+                id = 0;
+                t += 100;
+            }
+        }
+        system.insertEntries(batch.data(), batch.size());
+        now.store(t, std::memory_order_relaxed);
+        inserted += batch.size();
+    }
+    double elapsed = std::chrono::duration< double >(
+        std::chrono::steady_clock::now() - start).count();
+    stop = true;
+    for (auto & th : threads) th.join();
+
+    unsigned long total = 0;
+    for (int r = 0; r < READERS; r++) total += counts[r * 16];
+    ingest = inserted / elapsed;
+    queries = total / elapsed;
+}
+
+/**
+ * @brief      Benchmark main application.
+ *
+ * @return     0 on success.
+ */
+int main()
+{
+    std::cout << std::setw(8) << "nodes"
+        << std::setw(18) << "samples/s"
+        << std::setw(18) << "queries/s"
+        << std::endl;
+
+    for (size_t nodes = 2; nodes <= 512; nodes *= 2)
+    {
+        double ingest, queries;
+        run(nodes, ingest, queries);
+        std::cout << std::fixed << std::setprecision(0)
+            << std::setw(8) << nodes
+            << std::setw(18) << ingest
+            << std::setw(18) << queries
+            << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,219 @@
+/**
+ * @file    rpi/bench/tcp_bench.cpp
+ *
+ * @brief   TCP request load benchmark
+ *
+ * Serves a System from an in-process TCPServer and runs a number of load
+ * clients against it, each sending batches of pipelined 'g l (i)' requests,
+ * in either protocol, and waiting for every response before sending the next
+ * batch. Reports the request rate, the bytes received per response and the
+ * round-trip latency of a batch.
+ *
+ * @author  João Borrego
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include <boost/asio.hpp>
+
+#include "../src/System.hpp"
+#include "../src/TCPServer.hpp"
+#include "../src/request.hpp"
+
+/** Number of nodes */
+const size_t BENCH_NODES = 2;
+/** Listening port, away from the server's */
+const unsigned short BENCH_PORT = PORT + 100;
+/** Duration of each measurement (ms) */
+const int DURATION = 1000;
+/** Size of a binary response carrying a value */
+const size_t BINARY_RESPONSE = BINARY_LENGTH_SIZE + BINARY_HEADER_SIZE + sizeof(float);
+
+/**
+ * @brief      Class for a load client's results.
+ */
+class LoadResult
+{
+
+public:
+
+    /** Responses received */
+    unsigned long responses;
+    /** Bytes received */
+    unsigned long bytes;
+    /** Batch round-trip latencies (us) */
+    std::vector< double > latencies;
+
+    /**
+     * @brief      Constructs empty results.
+     */
+    LoadResult() : responses(0), bytes(0) {}
+};
+
+/**
+ * @brief      Runs a load client until stopped.
+ *
+ * @param[in]  batch   The number of requests pipelined per round trip
+ * @param[in]  binary  Whether to use the binary protocol
+ * @param[in]  stop    The stop flag
+ * @param      result  The results
+ */
+void loadClient(size_t batch, bool binary, const std::atomic< bool > & stop,
+    LoadResult & result)
+{
+    boost::asio::io_service io;
+    tcp::socket socket(io);
+    socket.connect(tcp::endpoint(
+        boost::asio::ip::address::from_string(HOST), BENCH_PORT));
+    socket.set_option(tcp::no_delay(true));
+
+    char buffer[1 << 16];
+    std::string requests;
+    if (binary)
+    {
+        std::string handshake(1, (char) BINARY_HANDSHAKE);
+        boost::asio::write(socket, boost::asio::buffer(handshake));
+        boost::asio::read(socket, boost::asio::buffer(buffer, handshake.size()));
+    }
+    for (size_t i = 0; i < batch; i++)
+    {
+        if (binary)
+        {
+            const char frame[] = {BINARY_HEADER_SIZE, 0, LUX, (char) (i % BENCH_NODES), 0};
+            requests.append(frame, sizeof(frame));
+        }
+        else
+        {
+            requests += "g l " + std::to_string(i % BENCH_NODES) + MSG_DELIMETER;
+        }
+    }
+
+    while (!stop.load(std::memory_order_relaxed))
+    {
+        auto before = std::chrono::steady_clock::now();
+        boost::asio::write(socket, boost::asio::buffer(requests));
+
+        // Text responses end with a delimiter, whichever their framing
+        size_t pending = (binary)? batch * BINARY_RESPONSE : batch;
+        while (pending)
+        {
+            size_t n = socket.read_some(boost::asio::buffer(buffer));
+            result.bytes += n;
+            pending -= std::min(pending, (binary)? n :
+                (size_t) std::count(buffer, buffer + n, MSG_DELIMETER));
+        }
+        auto after = std::chrono::steady_clock::now();
+
+        result.responses += batch;
+        result.latencies.push_back(
+            std::chrono::duration< double, std::micro >(after - before).count());
+    }
+}
+
+/**
+ * @brief      Runs load clients against the server.
+ *
+ * @param[in]  clients  The number of clients
+ * @param[in]  batch    The number of requests pipelined per round trip
+ * @param[in]  binary   Whether to use the binary protocol
+ * @param      result   The merged results
+ *
+ * @return     Responses per second.
+ */
+double run(int clients, size_t batch, bool binary, LoadResult & result)
+{
+    std::atomic< bool > stop(false);
+    std::vector< LoadResult > results(clients);
+    std::vector< std::thread > threads;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int c = 0; c < clients; c++)
+    {
+        threads.emplace_back(loadClient, batch, binary, std::cref(stop),
+            std::ref(results[c]));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(DURATION));
+    stop = true;
+    for (auto & th : threads) th.join();
+    double elapsed = std::chrono::duration< double >(
+        std::chrono::steady_clock::now() - start).count();
+
+    for (const LoadResult & r : results)
+    {
+        result.responses += r.responses;
+        result.bytes += r.bytes;
+        result.latencies.insert(result.latencies.end(),
+            r.latencies.begin(), r.latencies.end());
+    }
+    return result.responses / elapsed;
+}
+
+/**
+ * @brief      Benchmark main application.
+ *
+ * @return     0 on success.
+ */
+int main()
+{
+    System::ptr system(new System(BENCH_NODES, T_S, HISTORY_CAPACITY, HISTORY_RETENTION));
+    for (size_t id = 0; id < BENCH_NODES; id++)
+    {
+        system->insertEntry(id, 0, 30.0, 0.5, 33.3);
+    }
+
+    boost::asio::io_service io;
+    TCPServer server(io, BENCH_PORT, system);
+    std::vector< std::thread > pool;
+    for (int i = 0; i < TCP_THREADS; i++)
+    {
+        pool.emplace_back([&io]{ io.run(); });
+    }
+
+    // Sessions trace every request to standard output, which is discarded
+    std::ostream out(std::cout.rdbuf());
+    std::cout.rdbuf(nullptr);
+
+    out << std::setw(10) << "protocol" << std::setw(8) << "clients" << std::setw(8) << "batch"
+        << std::setw(14) << "requests/s" << std::setw(16) << "bytes/response"
+        << std::setw(14) << "mean rtt us" << std::setw(14) << "p99 rtt us"
+        << std::endl;
+
+    for (bool binary : {false, true})
+    {
+        for (int clients : {1, 4})
+        {
+            for (size_t batch : {1, 12})
+            {
+                LoadResult result;
+                double rate = run(clients, batch, binary, result);
+
+                std::vector< double > & l = result.latencies;
+                std::sort(l.begin(), l.end());
+                double mean = 0;
+                for (double x : l) mean += x;
+                mean /= std::max< size_t >(l.size(), 1);
+                double p99 = (l.empty())? 0 : l[(l.size() - 1) * 99 / 100];
+
+                out << std::fixed << std::setprecision(0)
+                    << std::setw(10) << ((binary)? "binary" : "text")
+                    << std::setw(8) << clients << std::setw(8) << batch
+                    << std::setw(14) << rate
+                    << std::setprecision(1)
+                    << std::setw(16) << (double) result.bytes / std::max(result.responses, 1UL)
+                    << std::setw(14) << mean << std::setw(14) << p99
+                    << std::endl;
+            }
+        }
+    }
+
+    io.stop();
+    for (auto & th : pool) th.join();
+    return 0;
+}
@@ -0,0 +1,247 @@
+/**
+ * @file    rpi/src/Archive.cpp
+ *
+ * @brief   Compressed cold log storage implementation
+ *
+ * Keeps log entries displaced from a node's hot history in compressed
+ * blocks, using delta-of-delta timestamps and XOR-encoded values (as in
+ * Facebook's Gorilla). Values are encoded at the history's 16-bit
+ * quantisation, so that sensor noise below it does not inflate the XORs.
+ * Blocks are decoded on the fly by queries.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#include "Archive.hpp"
+
+namespace
+{
+    /**
+     * @brief      Class for a sequential bit stream reader.
+     */
+    class BitReader
+    {
+
+    private:
+
+        /** Encoded words */
+        const std::vector< uint64_t > & words_;
+        /** Position of the next bit */
+        size_t pos_;
+
+    public:
+
+        /**
+         * @brief      Constructs a reader at the start of a stream.
+         *
+         * @param[in]  words  The encoded words
+         */
+        explicit BitReader(const std::vector< uint64_t > & words)
+            : words_(words), pos_(0) {}
+
+        /**
+         * @brief      Reads bits from the stream.
+         *
+         * @param[in]  n     The number of bits, from 1 to 64
+         *
+         * @return     The value.
+         */
+        uint64_t read(unsigned n)
+        {
+            size_t word = pos_ >> 6;
+            unsigned offset = pos_ & 63;
+            uint64_t value = words_[word] >> offset;
+            if (offset + n > 64) value |= words_[word + 1] << (64 - offset);
+            if (n < 64) value &= (1ULL << n) - 1;
+            pos_ += n;
+            return value;
+        }
+    };
+
+    /**
+     * @brief      Sign-extends the n lowest bits of a value.
+     *
+     * @param[in]  value  The value
+     * @param[in]  n      The number of bits
+     *
+     * @return     The signed value.
+     */
+    long signExtend(uint64_t value, unsigned n)
+    {
+        return (n < 64)? (long) (value << (64 - n)) >> (64 - n) : (long) value;
+    }
+}
+
+void Block::write(uint64_t value, unsigned n)
+{
+    if (n < 64) value &= (1ULL << n) - 1;
+    unsigned offset = bits_ & 63;
+    if (offset == 0) words_.push_back(0);
+    words_.back() |= value << offset;
+    if (offset + n > 64) words_.push_back(value >> (64 - offset));
+    bits_ += n;
+}
+
+void Block::writeValue(int v, uint16_t value)
+{
+    unsigned x = value ^ values_[v];
+    values_[v] = value;
+
+    if (x == 0)
+    {
+        write(0, 1);
+        return;
+    }
+    unsigned leading = __builtin_clz(x) - 16;
+    unsigned trailing = __builtin_ctz(x);
+    if (leading >= leading_[v] && trailing >= trailing_[v])
+    {
+        // Meaningful bits fit in the previous window
+        write(0x1, 2);
+        write(x >> trailing_[v], 16 - leading_[v] - trailing_[v]);
+    }
+    else
+    {
+        unsigned length = 16 - leading - trailing;
+        write(0x3, 2);
+        write(leading, 4);
+        write(length - 1, 4);
+        write(x >> trailing, length);
+        leading_[v] = leading;
+        trailing_[v] = trailing;
+    }
+}
+
+void Block::push_back(const Entry & entry, const Metrics & before)
+{
+    uint16_t values[VALUES] = {
+        History::quantise(History::COL_LUX, entry.lux),
+        History::quantise(History::COL_DUTY_CYCLE, entry.duty_cycle),
+        History::quantise(History::COL_LUX_REFERENCE, entry.lux_reference),
+        entry.occupancy};
+
+    if (count_ == 0)
+    {
+        // Header: metrics, first timestamp and raw values
+        checkpoint_ = before;
+        first_ = entry.timestamp;
+        delta_ = 0;
+        for (int v = 0; v < VALUES; v++)
+        {
+            values_[v] = values[v];
+            leading_[v] = 16;
+            trailing_[v] = 0;
+            write(values_[v], 16);
+        }
+    }
+    else
+    {
+        long delta = (long) (entry.timestamp - last_);
+        long dod = delta - delta_;
+        delta_ = delta;
+
+        if (dod == 0)                         write(0x0, 1);
+        else if (dod >= -63 && dod <= 64)     { write(0x1, 2);  write(dod + 63, 7); }
+        else if (dod >= -255 && dod <= 256)   { write(0x3, 3);  write(dod + 255, 9); }
+        else if (dod >= -2047 && dod <= 2048) { write(0x7, 4);  write(dod + 2047, 12); }
+        else                                  { write(0xF, 4);  write(dod, 64); }
+
+        for (int v = 0; v < VALUES; v++)
+        {
+            writeValue(v, values[v]);
+        }
+    }
+    last_ = entry.timestamp;
+    count_++;
+}
+
+void Block::decode(std::vector< Entry > & entries, float sample_period) const
+{
+    entries.resize(count_);
+    if (count_ == 0) return;
+
+    BitReader reader(words_);
+    Metrics metrics = checkpoint_;
+    uint16_t values[VALUES];
+    unsigned leading[VALUES], trailing[VALUES];
+    unsigned long t = first_;
+    long delta = 0;
+
+    for (int v = 0; v < VALUES; v++)
+    {
+        values[v] = reader.read(16);
+        leading[v] = 16;
+        trailing[v] = 0;
+    }
+
+    for (size_t i = 0; i < count_; i++)
+    {
+        if (i > 0)
+        {
+            long dod;
+            if (reader.read(1) == 0)      dod = 0;
+            else if (reader.read(1) == 0) dod = (long) reader.read(7) - 63;
+            else if (reader.read(1) == 0) dod = (long) reader.read(9) - 255;
+            else if (reader.read(1) == 0) dod = (long) reader.read(12) - 2047;
+            else                          dod = signExtend(reader.read(64), 64);
+            delta += dod;
+            t += delta;
+
+            for (int v = 0; v < VALUES; v++)
+            {
+                if (reader.read(1) == 0) continue;
+                if (reader.read(1) == 1)
+                {
+                    leading[v] = reader.read(4);
+                    unsigned length = reader.read(4) + 1;
+                    trailing[v] = 16 - leading[v] - length;
+                }
+                unsigned length = 16 - leading[v] - trailing[v];
+                values[v] ^= reader.read(length) << trailing[v];
+            }
+        }
+
+        float lux = History::dequantise(History::COL_LUX, values[0]);
+        float duty_cycle = History::dequantise(History::COL_DUTY_CYCLE, values[1]);
+        float lux_reference = History::dequantise(History::COL_LUX_REFERENCE, values[2]);
+        metrics.update(t, lux, duty_cycle, lux_reference);
+        entries[i] = Entry(t, lux, duty_cycle, lux_reference,
+            metrics.comfortError(), metrics.comfortVariance(sample_period),
+            values[3] != 0);
+    }
+}
+
+size_t Archive::size() const
+{
+    size_t total = 0;
+    for (const Block & block : blocks_) total += block.size();
+    return total;
+}
+
+size_t Archive::bytes() const
+{
+    size_t total = sizeof(Archive);
+    for (const Block & block : blocks_) total += block.bytes();
+    return total;
+}
+
+void Archive::push_back(const Entry & entry, const Metrics & before)
+{
+    if (capacity_ == 0) return;
+    if (blocks_.empty() || blocks_.back().full())
+    {
+        if (!blocks_.empty()) blocks_.back().shrink();
+        if (blocks_.size() == capacity_) blocks_.pop_front();
+        blocks_.emplace_back();
+    }
+    blocks_.back().push_back(entry, before);
+}
+
+void Archive::expire(unsigned long t)
+{
+    while (!blocks_.empty() && blocks_.front().last() < t)
+    {
+        blocks_.pop_front();
+    }
+}
@@ -0,0 +1,245 @@
+/**
+ * @file    rpi/src/Archive.hpp
+ *
+ * @brief   Compressed cold log storage headers
+ *
+ * Keeps log entries displaced from a node's hot history in compressed
+ * blocks, using delta-of-delta timestamps and XOR-encoded values (as in
+ * Facebook's Gorilla). Values are encoded at the history's 16-bit
+ * quantisation, so that sensor noise below it does not inflate the XORs.
+ * Blocks are decoded on the fly by queries.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#ifndef ARCHIVE_HPP
+#define ARCHIVE_HPP
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+#include "History.hpp"
+#include "Metrics.hpp"
+
+/**
+ * @brief      Class for a compressed block of log entries.
+ *
+ * Entries are encoded as they are appended. Comfort metrics are not stored,
+ * but replayed on decoding from the metrics prior to the first entry.
+ */
+class Block
+{
+
+public:
+
+    /** Maximum number of entries per block */
+    static const size_t ENTRIES = 1024;
+
+private:
+
+    /** Number of encoded fields per entry, matching the history columns */
+    static const int VALUES = History::COLUMNS;
+
+    /** Metrics prior to the first entry */
+    Metrics checkpoint_;
+    /** Number of entries */
+    size_t count_;
+    /** Timestamp of the first entry */
+    unsigned long first_;
+    /** Timestamp of the latest entry */
+    unsigned long last_;
+    /** Latest timestamp delta */
+    long delta_;
+    /** Latest quantised values */
+    uint16_t values_[VALUES];
+    /** Leading zeros of the latest XOR window, for each value */
+    unsigned leading_[VALUES];
+    /** Trailing zeros of the latest XOR window, for each value */
+    unsigned trailing_[VALUES];
+
+    /** Encoded bit stream, least significant bit first */
+    std::vector< uint64_t > words_;
+    /** Number of bits written */
+    size_t bits_;
+
+public:
+
+    /**
+     * @brief      Constructs an empty block.
+     */
+    Block() : count_(0), first_(0), last_(0), delta_(0), bits_(0) {}
+
+    /**
+     * @brief      Gets the number of entries.
+     *
+     * @return     The size.
+     */
+    size_t size() const { return count_; }
+
+    /**
+     * @brief      Checks whether the block is full.
+     *
+     * @return     True if full, false otherwise.
+     */
+    bool full() const { return count_ == ENTRIES; }
+
+    /**
+     * @brief      Gets the timestamp of the first entry.
+     *
+     * @return     The timestamp.
+     */
+    unsigned long first() const { return first_; }
+
+    /**
+     * @brief      Gets the timestamp of the latest entry.
+     *
+     * @return     The timestamp.
+     */
+    unsigned long last() const { return last_; }
+
+    /**
+     * @brief      Gets the memory used by the block.
+     *
+     * @return     The size in bytes.
+     */
+    size_t bytes() const
+    {
+        return sizeof(Block) + words_.capacity() * sizeof(uint64_t);
+    }
+
+    /**
+     * @brief      Appends an entry.
+     *
+     * @param[in]  entry   The entry
+     * @param[in]  before  The metrics prior to the entry
+     */
+    void push_back(const Entry & entry, const Metrics & before);
+
+    /**
+     * @brief      Releases spare encoding memory, once the block is full.
+     */
+    void shrink() { words_.shrink_to_fit(); }
+
+    /**
+     * @brief      Decodes every entry.
+     *
+     * @param      entries        The output entries
+     * @param[in]  sample_period  The sampling period (s)
+     */
+    void decode(std::vector< Entry > & entries, float sample_period) const;
+
+private:
+
+    /**
+     * @brief      Appends bits to the stream.
+     *
+     * @param[in]  value  The value, whose n lowest bits are written
+     * @param[in]  n      The number of bits, up to 64
+     */
+    void write(uint64_t value, unsigned n);
+
+    /**
+     * @brief      Encodes a quantised value as the XOR with its predecessor.
+     *
+     * @param[in]  v      The value index
+     * @param[in]  value  The value
+     */
+    void writeValue(int v, uint16_t value);
+};
+
+/**
+ * @brief      Class for a node's compressed cold log.
+ *
+ * Entries must be appended in non-decreasing timestamp order. When full,
+ * the oldest block is discarded.
+ */
+class Archive
+{
+
+private:
+
+    /** Blocks, from the oldest to the newest */
+    std::deque< Block > blocks_;
+    /** Maximum number of blocks */
+    size_t capacity_;
+    /** Sampling period (s), for comfort variance */
+    float sample_period_;
+
+public:
+
+    /**
+     * @brief      Constructs an archive.
+     *
+     * @param[in]  capacity       The maximum number of entries, 0 to disable
+     * @param[in]  sample_period  The sampling period (s)
+     */
+    explicit Archive(size_t capacity = 0, float sample_period = 0)
+        : capacity_((capacity + Block::ENTRIES - 1) / Block::ENTRIES),
+          sample_period_(sample_period) {}
+
+    /**
+     * @brief      Gets the number of stored entries.
+     *
+     * @return     The size.
+     */
+    size_t size() const;
+
+    /**
+     * @brief      Gets the memory used by the archive.
+     *
+     * @return     The size in bytes.
+     */
+    size_t bytes() const;
+
+    /**
+     * @brief      Removes every entry.
+     */
+    void clear() { blocks_.clear(); }
+
+    /**
+     * @brief      Appends an entry.
+     *
+     * @param[in]  entry   The entry
+     * @param[in]  before  The metrics prior to the entry
+     */
+    void push_back(const Entry & entry, const Metrics & before);
+
+    /**
+     * @brief      Discards blocks whose entries are all older than t.
+     *
+     * @param[in]  t     The timestamp
+     */
+    void expire(unsigned long t);
+
+    /**
+     * @brief      Visits the entries within a time period, in order.
+     *
+     * Only blocks overlapping the period are decoded.
+     *
+     * @param[in]  start  The period start
+     * @param[in]  end    The period end
+     * @param[in]  f      The visitor, called as f(const Entry & entry)
+     *
+     * @tparam     F      The visitor type
+     */
+    template < typename F >
+    void forEachEntry(unsigned long start, unsigned long end, F f) const
+    {
+        std::vector< Entry > entries;
+        auto it = std::lower_bound(blocks_.begin(), blocks_.end(), start,
+            [](const Block & block, unsigned long t){ return block.last() < t; });
+        for (; it != blocks_.end() && it->first() <= end; ++it)
+        {
+            it->decode(entries, sample_period_);
+            for (const Entry & e : entries)
+            {
+                if (e.timestamp >= start && e.timestamp <= end) f(e);
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,225 @@
+/**
+ * @file    rpi/src/History.cpp
+ *
+ * @brief   Columnar log entry storage implementation
+ *
+ * Stores a node's log entries as a structure of arrays, with one segmented
+ * buffer per field, so that range scans only touch the columns they need.
+ * Appends never move stored entries.
+ *
+ * Fields are stored compactly: timestamps as 32-bit offsets from a base,
+ * illuminance, duty cycle and occupancy quantised to 16 bits, and comfort metrics
+ * derived on access from periodic checkpoints instead of being stored.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#include "History.hpp"
+
+#include <cmath>
+#include <limits>
+
+// Illuminance at 0.02 lx up to 1310 lx, well below the LDR's ADC resolution;
+// duty cycle over [0, 1] at 16 bits, finer than the 8-bit PWM output;
+// occupancy as 0 or 1
+const float History::STEPS[COLUMNS] = {0.02f, 1.0f / 65535, 0.02f, 1.0f};
+
+History::History(size_t capacity, float sample_period)
+    : sample_period_(sample_period),
+      base_(0),
+      first_(0),
+      offsets_(capacity),
+      checkpoints_((capacity)? capacity / CHECKPOINT_INTERVAL + 2 : 0)
+{
+    for (int col = 0; col < COLUMNS; col++)
+    {
+        columns_[col] = SegmentedBuffer< uint16_t >(capacity);
+    }
+}
+
+void History::clear()
+{
+    offsets_.clear();
+    for (int col = 0; col < COLUMNS; col++)
+    {
+        columns_[col].clear();
+    }
+    checkpoints_.clear();
+    metrics_.reset();
+    base_ = 0;
+    first_ = 0;
+}
+
+void History::push_back(const Entry & entry)
+{
+    const unsigned long max_offset = std::numeric_limits< uint32_t >::max();
+
+    if (capacity())
+    {
+        if (offsets_.full())
+        {
+            pop_front();
+        }
+        if (!empty() && entry.timestamp - base_ > max_offset)
+        {
+            // Keep only entries which fit in offsets from a common base
+            while (!empty() && entry.timestamp - timestamp(0) > max_offset)
+            {
+                pop_front();
+            }
+            if (!empty())
+            {
+                uint32_t shift = offsets_[0];
+                for (size_t i = 0; i < size(); i++) offsets_[i] -= shift;
+                base_ += shift;
+            }
+        }
+
+        if (empty())
+        {
+            base_ = entry.timestamp;
+            checkpoints_.clear();
+            checkpoints_.push_back(metrics_);
+        }
+        else if ((first_ + size()) % CHECKPOINT_INTERVAL == 0)
+        {
+            checkpoints_.push_back(metrics_);
+        }
+
+        offsets_.push_back(entry.timestamp - base_);
+        columns_[COL_LUX].push_back(quantise(COL_LUX, entry.lux));
+        columns_[COL_DUTY_CYCLE].push_back(quantise(COL_DUTY_CYCLE, entry.duty_cycle));
+        columns_[COL_LUX_REFERENCE].push_back(quantise(COL_LUX_REFERENCE, entry.lux_reference));
+        columns_[COL_OCCUPANCY].push_back(entry.occupancy);
+    }
+
+    // Metrics use the exact values, as received
+    metrics_.update(entry.timestamp, entry.lux, entry.duty_cycle,
+        entry.lux_reference);
+}
+
+void History::pop_front()
+{
+    if (empty()) return;
+
+    // Carry the oldest checkpoint over the discarded entry, until the next
+    // checkpoint takes over
+    Metrics & oldest = checkpoints_[0];
+    oldest.update(timestamp(0), value(COL_LUX, 0), value(COL_DUTY_CYCLE, 0),
+        value(COL_LUX_REFERENCE, 0));
+
+    offsets_.pop_front();
+    for (int col = 0; col < COLUMNS; col++)
+    {
+        columns_[col].pop_front();
+    }
+    first_++;
+    if (first_ % CHECKPOINT_INTERVAL == 0 && checkpoints_.size() > 1)
+    {
+        checkpoints_.pop_front();
+    }
+}
+
+uint16_t History::quantise(Column col, float v)
+{
+    float q = std::round(v / STEPS[col]);
+    q = std::min(std::max(q, 0.0f), (float) std::numeric_limits< uint16_t >::max());
+    return (uint16_t) q;
+}
+
+size_t History::replayTo(size_t i, Metrics & m) const
+{
+    size_t cp = checkpoint(i);
+    m = checkpoints_[cp];
+    return (cp == 0)? 0 :
+        (first_ + i) / CHECKPOINT_INTERVAL * CHECKPOINT_INTERVAL - first_;
+}
+
+Entry History::replay(size_t i, Metrics & m) const
+{
+    unsigned long t = timestamp(i);
+    float lux = value(COL_LUX, i);
+    float duty_cycle = value(COL_DUTY_CYCLE, i);
+    float lux_reference = value(COL_LUX_REFERENCE, i);
+    m.update(t, lux, duty_cycle, lux_reference);
+    return Entry(t, lux, duty_cycle, lux_reference,
+        m.comfortError(), m.comfortVariance(sample_period_),
+        columns_[COL_OCCUPANCY][i] != 0);
+}
+
+Metrics History::metricsBefore(size_t i) const
+{
+    if (i >= size()) return metrics_;
+    Metrics m;
+    for (size_t j = replayTo(i, m); j < i; j++)
+    {
+        replay(j, m);
+    }
+    return m;
+}
+
+Entry History::entry(size_t i) const
+{
+    Metrics m = metricsBefore(i);
+    return replay(i, m);
+}
+
+size_t History::lowerBound(unsigned long t) const
+{
+    if (t <= base_) return 0;
+    if (t - base_ > std::numeric_limits< uint32_t >::max()) return size();
+    uint32_t offset = t - base_;
+
+    // Timestamps are sorted: binary search down to a short window,
+    // then finish with a branchless scan over it
+    size_t first = 0, last = size();
+    while (last - first > SCAN_WINDOW)
+    {
+        size_t mid = first + (last - first) / 2;
+        if (offsets_[mid] < offset) first = mid + 1;
+        else                        last = mid;
+    }
+    size_t count = first;
+    offsets_.forEachSpan(first, last,
+        [&](const uint32_t *data, size_t n){
+            count += Kernels::countLess(data, n, offset);
+        });
+    return count;
+}
+
+size_t History::upperBound(unsigned long t) const
+{
+    // Timestamps are integral, so t < x <=> t + 1 <= x
+    return lowerBound(t + 1);
+}
+
+double History::sum(Column col, size_t first, size_t last) const
+{
+    uint64_t total = 0;
+    columns_[col].forEachSpan(first, last,
+        [&](const uint16_t *data, size_t n){
+            total += Kernels::sum(data, n);
+        });
+    return total * (double) STEPS[col];
+}
+
+float History::min(Column col, size_t first, size_t last) const
+{
+    uint16_t result = columns_[col][first];
+    columns_[col].forEachSpan(first, last,
+        [&](const uint16_t *data, size_t n){
+            result = std::min(result, Kernels::minimum(data, n));
+        });
+    return result * STEPS[col];
+}
+
+float History::max(Column col, size_t first, size_t last) const
+{
+    uint16_t result = columns_[col][first];
+    columns_[col].forEachSpan(first, last,
+        [&](const uint16_t *data, size_t n){
+            result = std::max(result, Kernels::maximum(data, n));
+        });
+    return result * STEPS[col];
+}
@@ -0,0 +1,440 @@
+/**
+ * @file    rpi/src/History.hpp
+ *
+ * @brief   Columnar log entry storage headers
+ *
+ * Stores a node's log entries as a structure of arrays, with one segmented
+ * buffer per field, so that range scans only touch the columns they need.
+ * Appends never move stored entries.
+ *
+ * Fields are stored compactly: timestamps as 32-bit offsets from a base,
+ * illuminance, duty cycle and occupancy quantised to 16 bits, and comfort metrics
+ * derived on access from periodic checkpoints instead of being stored.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#ifndef HISTORY_HPP
+#define HISTORY_HPP
+
+#include <cstdint>
+
+#include "SegmentedBuffer.hpp"
+#include "Metrics.hpp"
+#include "kernels.hpp"
+
+/**
+ * @brief      Class for entry.
+ */
+class Entry
+{
+
+public:
+
+    /** Entry timestamp */
+    unsigned long timestamp;
+    /** Registered lux value */
+    float lux;
+    /** Registered duty cycle */
+    float duty_cycle;
+    /** Reference illuminance */
+    float lux_reference;
+    /** Comfort error */
+    float c_err;
+    /** Comfort variance */
+    float c_var;
+    /** Occupancy */
+    bool occupancy;
+
+    /**
+     * @brief      Constructs an empty entry.
+     */
+    Entry()
+        : timestamp(0),
+          lux(0),
+          duty_cycle(0),
+          lux_reference(0),
+          c_err(0),
+          c_var(0),
+          occupancy(false){}
+
+    /**
+     * @brief      Constructs an entry.
+     *
+     * @param[in]  timestamp_      The timestamp
+     * @param[in]  lux_            The lux
+     * @param[in]  duty_cycle_     The duty cycle
+     * @param[in]  lux_reference_  The lux reference
+     * @param[in]  c_err_          The comfort error
+     * @param[in]  c_var_          The comfort variance
+     * @param[in]  occupancy_      The occupancy
+     */
+    Entry(
+        unsigned long timestamp_,
+        float lux_,
+        float duty_cycle_,
+        float lux_reference_,
+        float c_err_,
+        float c_var_,
+        bool occupancy_ = false)
+        : timestamp(timestamp_),
+          lux(lux_),
+          duty_cycle(duty_cycle_),
+          lux_reference(lux_reference_),
+          c_err(c_err_),
+          c_var(c_var_),
+          occupancy(occupancy_){}
+};
+
+/**
+ * @brief      Class for a node's columnar log history.
+ *
+ * Entries are indexed from the oldest (0) to the newest (size() - 1), and
+ * must be inserted in non-decreasing timestamp order. Entries older than
+ * 2^32 ms with respect to the newest one are discarded.
+ *
+ * The history also keeps the node's running metrics since the last clear,
+ * which are unaffected by entries being discarded.
+ */
+class History
+{
+
+public:
+
+    /** Quantised columns */
+    enum Column
+    {
+        COL_LUX = 0,
+        COL_DUTY_CYCLE,
+        COL_LUX_REFERENCE,
+        COL_OCCUPANCY,
+        COLUMNS
+    };
+
+    /** Quantisation step of each column */
+    static const float STEPS[COLUMNS];
+
+private:
+
+    /** Range length below which searches switch to a linear scan */
+    static const size_t SCAN_WINDOW = 32;
+    /** Number of entries between metrics checkpoints */
+    static const size_t CHECKPOINT_INTERVAL = 64;
+
+    /** Sampling period (s), for comfort variance */
+    float sample_period_;
+    /** Timestamp the offsets are relative to */
+    unsigned long base_;
+    /** Sequence number of the oldest entry since last clear */
+    unsigned long first_;
+
+    /** Timestamp offset column */
+    SegmentedBuffer< uint32_t > offsets_;
+    /** Quantised columns */
+    SegmentedBuffer< uint16_t > columns_[COLUMNS];
+
+    /** Running metrics, up to the newest entry */
+    Metrics metrics_;
+    /**
+     * Metrics prior to the oldest entry, then prior to every later entry
+     * whose sequence number is a multiple of CHECKPOINT_INTERVAL
+     */
+    SegmentedBuffer< Metrics, 64 > checkpoints_;
+
+public:
+
+    /**
+     * @brief      Constructs a history.
+     *
+     * @param[in]  capacity       The maximum number of entries
+     * @param[in]  sample_period  The sampling period (s)
+     */
+    explicit History(size_t capacity = 0, float sample_period = 0);
+
+    /**
+     * @brief      Gets the maximum number of entries.
+     *
+     * @return     The capacity.
+     */
+    size_t capacity() const { return offsets_.capacity(); }
+
+    /**
+     * @brief      Gets the number of stored entries.
+     *
+     * @return     The size.
+     */
+    size_t size() const { return offsets_.size(); }
+
+    /**
+     * @brief      Checks whether the history is empty.
+     *
+     * @return     True if empty, false otherwise.
+     */
+    bool empty() const { return offsets_.empty(); }
+
+    /**
+     * @brief      Checks whether the history is full.
+     *
+     * @return     True if full, false otherwise.
+     */
+    bool full() const { return capacity() && offsets_.full(); }
+
+    /**
+     * @brief      Gets the running metrics since last clear.
+     *
+     * @return     The metrics.
+     */
+    const Metrics & metrics() const { return metrics_; }
+
+    /**
+     * @brief      Removes every entry and resets the running metrics.
+     */
+    void clear();
+
+    /**
+     * @brief      Appends an entry, discarding the oldest one if full.
+     *
+     * The entry's comfort metrics are ignored, as they are derived.
+     *
+     * @param[in]  entry  The entry
+     */
+    void push_back(const Entry & entry);
+
+    /**
+     * @brief      Removes the oldest entry.
+     */
+    void pop_front();
+
+    /**
+     * @brief      Gets the timestamp of an entry.
+     *
+     * @param[in]  i     The entry index
+     *
+     * @return     The timestamp.
+     */
+    unsigned long timestamp(size_t i) const { return base_ + offsets_[i]; }
+
+    /**
+     * @brief      Gets a field of an entry.
+     *
+     * @param[in]  col   The column
+     * @param[in]  i     The entry index
+     *
+     * @return     The value.
+     */
+    float value(Column col, size_t i) const { return dequantise(col, columns_[col][i]); }
+
+    /**
+     * @brief      Assembles an entry from its columns.
+     *
+     * Comfort metrics are replayed from the nearest checkpoint, in at most
+     * CHECKPOINT_INTERVAL steps.
+     *
+     * @param[in]  i     The entry index
+     *
+     * @return     The entry.
+     */
+    Entry entry(size_t i) const;
+
+    /**
+     * @brief      Gets the running metrics prior to an entry.
+     *
+     * @param[in]  i     The entry index, or the size for the running metrics
+     *
+     * @return     The metrics.
+     */
+    Metrics metricsBefore(size_t i) const;
+
+    /**
+     * @brief      Visits the entries in an index range, in order.
+     *
+     * Comfort metrics are replayed once along the range.
+     *
+     * @param[in]  first  The first entry index
+     * @param[in]  last   The index past the last entry
+     * @param[in]  f      The visitor, called as f(const Entry & entry)
+     *
+     * @tparam     F      The visitor type
+     */
+    template < typename F >
+    void forEachEntry(size_t first, size_t last, F f) const
+    {
+        if (last > size()) last = size();
+        if (first >= last) return;
+        Metrics m;
+        size_t i = replayTo(first, m);
+        for (; i < last; i++)
+        {
+            if (i > 0 && (first_ + i) % CHECKPOINT_INTERVAL == 0)
+            {
+                m = checkpoints_[checkpoint(i)];
+            }
+            Entry e = replay(i, m);
+            if (i >= first) f(e);
+        }
+    }
+
+    /**
+     * @brief      Visits the values of a column in an index range, in order.
+     *
+     * @param[in]  col    The column
+     * @param[in]  first  The first entry index
+     * @param[in]  last   The index past the last entry
+     * @param[in]  f      The visitor, called as f(float value)
+     *
+     * @tparam     F      The visitor type
+     */
+    template < typename F >
+    void forEachValue(Column col, size_t first, size_t last, F f) const
+    {
+        float step = STEPS[col];
+        columns_[col].forEachSpan(first, last,
+            [&](const uint16_t *data, size_t n){
+                for (size_t i = 0; i < n; i++) f(data[i] * step);
+            });
+    }
+
+    /**
+     * @brief      Visits an index range as contiguous spans of every column.
+     *
+     * Spans are split wherever any column crosses a segment boundary, and
+     * hold at most max_length entries.
+     *
+     * @param[in]  first       The first entry index
+     * @param[in]  last        The index past the last entry
+     * @param[in]  max_length  The maximum span length
+     * @param[in]  f           The visitor, called as f(unsigned long base,
+     *                         const uint32_t * offsets, const uint16_t *
+     *                         const * columns, size_t n), timestamps being
+     *                         base + offsets[i]
+     *
+     * @tparam     F           The visitor type
+     */
+    template < typename F >
+    void forEachChunk(size_t first, size_t last, size_t max_length, F f) const
+    {
+        if (last > size()) last = size();
+        const uint16_t *columns[COLUMNS];
+        while (first < last)
+        {
+            size_t n = std::min(last - first, max_length);
+            const uint32_t *offsets = offsets_.span(first, n);
+            for (int col = 0; col < COLUMNS; col++)
+            {
+                columns[col] = columns_[col].span(first, n);
+            }
+            f(base_, offsets, columns, n);
+            first += n;
+        }
+    }
+
+    /**
+     * @brief      Finds the first entry with a timestamp not lower than t.
+     *
+     * Runs in logarithmic time.
+     *
+     * @param[in]  t     The timestamp
+     *
+     * @return     The entry index, or size() if none.
+     */
+    size_t lowerBound(unsigned long t) const;
+
+    /**
+     * @brief      Finds the first entry with a timestamp greater than t.
+     *
+     * @param[in]  t     The timestamp
+     *
+     * @return     The entry index, or size() if none.
+     */
+    size_t upperBound(unsigned long t) const;
+
+    /**
+     * @brief      Sums a column over an index range.
+     *
+     * @param[in]  col    The column
+     * @param[in]  first  The first entry index
+     * @param[in]  last   The index past the last entry
+     *
+     * @return     The sum.
+     */
+    double sum(Column col, size_t first, size_t last) const;
+
+    /**
+     * @brief      Obtains the minimum of a column over a non-empty index range.
+     *
+     * @param[in]  col    The column
+     * @param[in]  first  The first entry index
+     * @param[in]  last   The index past the last entry
+     *
+     * @return     The minimum.
+     */
+    float min(Column col, size_t first, size_t last) const;
+
+    /**
+     * @brief      Obtains the maximum of a column over a non-empty index range.
+     *
+     * @param[in]  col    The column
+     * @param[in]  first  The first entry index
+     * @param[in]  last   The index past the last entry
+     *
+     * @return     The maximum.
+     */
+    float max(Column col, size_t first, size_t last) const;
+
+    /**
+     * @brief      Quantises a value for a column.
+     *
+     * @param[in]  col   The column
+     * @param[in]  v     The value
+     *
+     * @return     The quantised value, saturated to the column range.
+     */
+    static uint16_t quantise(Column col, float v);
+
+    /**
+     * @brief      Restores a quantised value of a column.
+     *
+     * @param[in]  col   The column
+     * @param[in]  q     The quantised value
+     *
+     * @return     The value.
+     */
+    static float dequantise(Column col, uint16_t q) { return q * STEPS[col]; }
+
+private:
+
+    /**
+     * @brief      Gets the checkpoint preceding an entry.
+     *
+     * @param[in]  i     The entry index
+     *
+     * @return     The checkpoint index.
+     */
+    size_t checkpoint(size_t i) const
+    {
+        return (first_ + i) / CHECKPOINT_INTERVAL - first_ / CHECKPOINT_INTERVAL;
+    }
+
+    /**
+     * @brief      Restores the metrics checkpointed before an entry's block.
+     *
+     * @param[in]  i     The entry index
+     * @param      m     The output metrics
+     *
+     * @return     The index of the first entry to replay into m.
+     */
+    size_t replayTo(size_t i, Metrics & m) const;
+
+    /**
+     * @brief      Accumulates an entry into metrics and assembles it.
+     *
+     * @param[in]  i     The entry index
+     * @param      m     The metrics prior to the entry
+     *
+     * @return     The entry.
+     */
+    Entry replay(size_t i, Metrics & m) const;
+};
+
+#endif
@@ -0,0 +1,357 @@
+/**
+ * @file    rpi/src/Journal.cpp
+ *
+ * @brief   Append-only binary journal implementation
+ *
+ * Persists every ingested sample as a fixed-size record in a memory-mapped
+ * file, after a header describing the record schema. Appending is a copy
+ * into the mapping; the kernel writes pages back, and a periodic sync bounds
+ * what a power loss may discard. Records are flagged valid once complete,
+ * so the journal is recovered up to the last complete record after a crash.
+ * Files are mapped and scanned a JOURNAL_CHUNK window at a time, so neither
+ * address space nor recovery time grows with the journal.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#include "Journal.hpp"
+
+#include <cstring>
+#include <cstddef>
+#include <cstdio>
+#include <cerrno>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "debug.hpp"
+
+static_assert(sizeof(JournalRecord) == 32, "Journal records must be packed");
+static_assert(sizeof(JournalHeader) <= JournalHeader::SIZE, "Journal header too large");
+static_assert(JOURNAL_CHUNK % sizeof(JournalRecord) == 0, "Chunks must hold whole records");
+
+const char JournalHeader::MAGIC[8] = {'S', 'C', 'D', 'T', 'R', 'J', 'N', 'L'};
+
+const size_t JournalReader::WINDOW_RECORDS;
+const JournalRecord JournalReader::EMPTY = JournalRecord();
+
+namespace
+{
+    /** Records per mapped window, by writers as by readers */
+    const size_t WINDOW_RECORDS = JournalReader::WINDOW_RECORDS;
+
+    /** Record schema, written to new journals */
+    const JournalField SCHEMA[] = {
+        {"timestamp",       JournalField::TYPE_U64, offsetof(JournalRecord, timestamp)},
+        {"id",              JournalField::TYPE_U16, offsetof(JournalRecord, id)},
+        {"occupancy",       JournalField::TYPE_U8,  offsetof(JournalRecord, occupancy)},
+        {"flags",           JournalField::TYPE_U8,  offsetof(JournalRecord, flags)},
+        {"lux",             JournalField::TYPE_F32, offsetof(JournalRecord, lux)},
+        {"duty_cycle",      JournalField::TYPE_F32, offsetof(JournalRecord, duty_cycle)},
+        {"lux_reference",   JournalField::TYPE_F32, offsetof(JournalRecord, lux_reference)},
+        {"lux_lower_bound", JournalField::TYPE_F32, offsetof(JournalRecord, lux_lower_bound)},
+        {"lux_external",    JournalField::TYPE_F32, offsetof(JournalRecord, lux_external)}
+    };
+
+    /**
+     * @brief      Counts the valid records, up to the first one not flagged.
+     *
+     * The header count is not trusted, as its page may reach the disk before
+     * those of the records it covers, or after records appended since. The
+     * synced count is, as it is only written once its records are on disk,
+     * so the scan starts there, one window at a time.
+     *
+     * @param[in]  fd      The journal file descriptor
+     * @param[in]  synced  The number of records known to be valid
+     * @param[in]  limit   The number of records in the file
+     * @param      count   The number of valid records
+     *
+     * @return     True on success, false if the file could not be mapped.
+     */
+    bool countValid(int fd, size_t synced, size_t limit, size_t & count)
+    {
+        count = std::min(synced, limit);
+        while (count < limit)
+        {
+            size_t index = count / WINDOW_RECORDS;
+            void *window = mmap(nullptr, JOURNAL_CHUNK, PROT_READ, MAP_SHARED,
+                fd, JournalHeader::SIZE + (off_t) index * JOURNAL_CHUNK);
+            if (window == MAP_FAILED) return false;
+            const JournalRecord *records = static_cast< const JournalRecord * >(window);
+            size_t end = std::min(limit, (index + 1) * WINDOW_RECORDS);
+            while (count < end &&
+                (records[count % WINDOW_RECORDS].flags & JournalRecord::FLAG_VALID))
+            {
+                count++;
+            }
+            munmap(window, JOURNAL_CHUNK);
+            if (count < end) break;
+        }
+        return true;
+    }
+}
+
+bool JournalHeader::valid() const
+{
+    return std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0 &&
+        version == VERSION &&
+        header_size == SIZE &&
+        record_size == sizeof(JournalRecord);
+}
+
+bool Journal::open(const std::string & path, size_t nodes, float sample_period)
+{
+    close();
+    if (JournalHeader::SIZE % sysconf(_SC_PAGESIZE) != 0 ||
+        JOURNAL_CHUNK % sysconf(_SC_PAGESIZE) != 0)
+    {
+        errPrintTrace("Journal layout is not page aligned");
+        return false;
+    }
+
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ == -1)
+    {
+        errPrintTrace("Could not open journal " << path << ": " << strerror(errno));
+        return false;
+    }
+    path_ = path;
+
+    struct stat st;
+    bool created = (fstat(fd_, &st) == 0 && st.st_size == 0);
+    if (created && posix_fallocate(fd_, 0, JournalHeader::SIZE) != 0)
+    {
+        errPrintTrace("Could not allocate journal " << path);
+        close();
+        return false;
+    }
+    void *header = mmap(nullptr, JournalHeader::SIZE, PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd_, 0);
+    if (header == MAP_FAILED)
+    {
+        errPrintTrace("Could not map journal " << path << ": " << strerror(errno));
+        close();
+        return false;
+    }
+    header_ = static_cast< JournalHeader * >(header);
+
+    if (created)
+    {
+        std::memset(header_, 0, sizeof(JournalHeader));
+        std::memcpy(header_->magic, JournalHeader::MAGIC, sizeof(JournalHeader::MAGIC));
+        header_->version = JournalHeader::VERSION;
+        header_->header_size = JournalHeader::SIZE;
+        header_->record_size = sizeof(JournalRecord);
+        header_->fields = sizeof(SCHEMA) / sizeof(SCHEMA[0]);
+        header_->nodes = nodes;
+        header_->sample_period = sample_period;
+        header_->count = 0;
+        std::memcpy(header_->schema, SCHEMA, sizeof(SCHEMA));
+        count_ = 0;
+    }
+    else
+    {
+        if (st.st_size < (off_t) JournalHeader::SIZE || !header_->valid())
+        {
+            errPrintTrace("Not a compatible journal: " << path);
+            close();
+            return false;
+        }
+        // Recover the records flagged valid, whatever the header count
+        size_t limit = (st.st_size - JournalHeader::SIZE) / sizeof(JournalRecord);
+        if (!countValid(fd_, header_->synced, limit, count_))
+        {
+            errPrintTrace("Could not map journal " << path << ": " << strerror(errno));
+            close();
+            return false;
+        }
+        header_->count = count_;
+    }
+
+    if (!mapWindow(count_ / WINDOW_RECORDS))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void Journal::close()
+{
+    if (fd_ == -1) return;
+
+    if (window_)
+    {
+        munmap(window_, JOURNAL_CHUNK);
+        window_ = nullptr;
+    }
+    if (header_)
+    {
+        header_->count = count_;
+        munmap(header_, JournalHeader::SIZE);
+        header_ = nullptr;
+        // Trim the preallocated tail of the last window
+        if (ftruncate(fd_, JournalHeader::SIZE + count_ * sizeof(JournalRecord)) != 0)
+        {
+            errPrintTrace("Could not trim journal: " << strerror(errno));
+        }
+    }
+    fdatasync(fd_);
+    ::close(fd_);
+    fd_ = -1;
+    count_ = 0;
+}
+
+bool Journal::rotate()
+{
+    if (fd_ == -1) return false;
+
+    std::string path = path_;
+    size_t nodes = header_->nodes;
+    float sample_period = header_->sample_period;
+    close();
+    std::string previous = path + JOURNAL_PREVIOUS;
+    if (std::rename(path.c_str(), previous.c_str()) != 0)
+    {
+        errPrintTrace("Could not rename journal " << path << " to " << previous
+            << ": " << strerror(errno));
+    }
+    return open(path, nodes, sample_period);
+}
+
+bool Journal::mapWindow(size_t index)
+{
+    if (window_)
+    {
+        munmap(window_, JOURNAL_CHUNK);
+        window_ = nullptr;
+    }
+
+    // Allocate blocks upfront, so a full disk fails here and not on access
+    off_t offset = JournalHeader::SIZE + (off_t) index * JOURNAL_CHUNK;
+    if (posix_fallocate(fd_, offset, JOURNAL_CHUNK) != 0)
+    {
+        errPrintTrace("Could not extend journal");
+        return false;
+    }
+    void *window = mmap(nullptr, JOURNAL_CHUNK, PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd_, offset);
+    if (window == MAP_FAILED)
+    {
+        errPrintTrace("Could not map journal: " << strerror(errno));
+        return false;
+    }
+    window_ = static_cast< JournalRecord * >(window);
+    window_index_ = index;
+    return true;
+}
+
+bool Journal::append(const JournalRecord & record)
+{
+    if (fd_ == -1) return false;
+    if (count_ / WINDOW_RECORDS != window_index_ || !window_)
+    {
+        if (!mapWindow(count_ / WINDOW_RECORDS)) return false;
+    }
+
+    JournalRecord & slot = window_[count_ % WINDOW_RECORDS];
+    slot = record;
+    slot.flags = 0;
+    // The valid flag must not become visible before the rest of the record
+    __atomic_store_n(&slot.flags, record.flags | JournalRecord::FLAG_VALID,
+        __ATOMIC_RELEASE);
+    count_++;
+    __atomic_store_n(&header_->count, count_, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool Journal::appendReset(unsigned long epoch)
+{
+    JournalRecord record;
+    std::memset(&record, 0, sizeof(record));
+    record.timestamp = epoch;
+    record.flags = JournalRecord::FLAG_RESET;
+    return append(record);
+}
+
+void Journal::sync()
+{
+    if (fd_ == -1) return;
+
+    // Equivalent to msync(MS_SYNC) over every mapping of the file, including
+    // windows already unmapped, without racing the writer's remapping
+    uint64_t count = __atomic_load_n(&header_->count, __ATOMIC_ACQUIRE);
+    if (fdatasync(fd_) == 0)
+    {
+        // Reaches the disk with the next sync, never ahead of its records
+        header_->synced = count;
+    }
+}
+
+bool JournalReader::open(const std::string & path)
+{
+    close();
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ == -1) return false;
+
+    struct stat st;
+    if (fstat(fd_, &st) != 0 || st.st_size < (off_t) JournalHeader::SIZE ||
+        pread(fd_, &header_, sizeof(header_), 0) != (ssize_t) sizeof(header_) ||
+        !header_.valid())
+    {
+        close();
+        return false;
+    }
+    size_t limit = (st.st_size - JournalHeader::SIZE) / sizeof(JournalRecord);
+    if (!countValid(fd_, header_.synced, limit, count_))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool JournalReader::open(const JournalReader & other)
+{
+    close();
+    if (other.fd_ == -1) return false;
+
+    fd_ = dup(other.fd_);
+    if (fd_ == -1) return false;
+    header_ = other.header_;
+    count_ = other.count_;
+    return true;
+}
+
+void JournalReader::close()
+{
+    if (window_) munmap(const_cast< JournalRecord * >(window_), JOURNAL_CHUNK);
+    window_ = nullptr;
+    if (fd_ != -1) ::close(fd_);
+    fd_ = -1;
+    count_ = 0;
+}
+
+bool JournalReader::mapWindow(size_t index) const
+{
+    if (window_)
+    {
+        munmap(const_cast< JournalRecord * >(window_), JOURNAL_CHUNK);
+        window_ = nullptr;
+    }
+
+    // Records past the end of the file are never accessed, only mapped
+    void *window = mmap(nullptr, JOURNAL_CHUNK, PROT_READ, MAP_SHARED, fd_,
+        JournalHeader::SIZE + (off_t) index * JOURNAL_CHUNK);
+    if (window == MAP_FAILED)
+    {
+        errPrintTrace("Could not map journal: " << strerror(errno));
+        return false;
+    }
+    window_ = static_cast< const JournalRecord * >(window);
+    window_index_ = index;
+    return true;
+}
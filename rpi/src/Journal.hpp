@@ -0,0 +1,380 @@
+/**
+ * @file    rpi/src/Journal.hpp
+ *
+ * @brief   Append-only binary journal headers
+ *
+ * Persists every ingested sample as a fixed-size record in a memory-mapped
+ * file, after a header describing the record schema. Appending is a copy
+ * into the mapping; the kernel writes pages back, and a periodic sync bounds
+ * what a power loss may discard. Records are flagged valid once complete,
+ * so the journal is recovered up to the last complete record after a crash.
+ * Files are mapped and scanned a JOURNAL_CHUNK window at a time, so neither
+ * address space nor recovery time grows with the journal.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#include "constants.hpp"
+
+/**
+ * @brief      Class for a journal record.
+ *
+ * Sample records hold a timestamp relative to the latest reset, while reset
+ * records hold the absolute reset time, in ms since the Unix epoch.
+ */
+class JournalRecord
+{
+
+public:
+
+    /** Record is complete */
+    static const uint8_t FLAG_VALID = 0x01;
+    /** Record marks a system reset */
+    static const uint8_t FLAG_RESET = 0x02;
+
+    /** Timestamp (ms) */
+    uint64_t timestamp;
+    /** Node identifier */
+    uint16_t id;
+    /** Occupancy */
+    uint8_t occupancy;
+    /** Record flags, written last */
+    uint8_t flags;
+    /** Measured illuminance */
+    float lux;
+    /** Duty cycle */
+    float duty_cycle;
+    /** Reference illuminance */
+    float lux_reference;
+    /** Illuminance lower bound */
+    float lux_lower_bound;
+    /** External illuminance */
+    float lux_external;
+};
+
+/**
+ * @brief      Class for a record field description.
+ */
+class JournalField
+{
+
+public:
+
+    /** Field types */
+    enum Type : uint32_t
+    {
+        TYPE_U8 = 0,
+        TYPE_U16,
+        TYPE_U32,
+        TYPE_U64,
+        TYPE_F32,
+        TYPE_F64
+    };
+
+    /** Field name, null-terminated */
+    char name[20];
+    /** Field type */
+    Type type;
+    /** Offset within the record (bytes) */
+    uint32_t offset;
+};
+
+/**
+ * @brief      Class for the journal file header.
+ */
+class JournalHeader
+{
+
+public:
+
+    /** File identifier */
+    static const char MAGIC[8];
+    /** Format version */
+    static const uint32_t VERSION = 1;
+    /** Space reserved for the header, records start after it (bytes) */
+    static const size_t SIZE = 4096;
+    /** Maximum number of described fields */
+    static const size_t MAX_FIELDS = 16;
+
+    /** File identifier */
+    char magic[8];
+    /** Format version */
+    uint32_t version;
+    /** Header size (bytes) */
+    uint32_t header_size;
+    /** Record size (bytes) */
+    uint32_t record_size;
+    /** Number of record fields */
+    uint32_t fields;
+    /** Number of nodes in the system that created the journal */
+    uint32_t nodes;
+    /** Sampling period (s) */
+    float sample_period;
+    /** Number of records, a hint only: recovery counts the valid records */
+    uint64_t count;
+    /** Record schema */
+    JournalField schema[MAX_FIELDS];
+    /** Number of records known to be on disk, where recovery starts counting */
+    uint64_t synced;
+
+    /**
+     * @brief      Checks whether the header describes a readable journal.
+     *
+     * @return     True if valid, false otherwise.
+     */
+    bool valid() const;
+};
+
+/**
+ * @brief      Class for a journal writer.
+ *
+ * Maps a window of the file at a time, extended in JOURNAL_CHUNK steps, so
+ * that the address space used does not grow with the journal. Not
+ * thread-safe, except for sync, which may run concurrently with appends.
+ *
+ * A journal may be rotated, continuing in a new file while the former one
+ * is kept aside, so that the disk space used is bounded by the caller.
+ */
+class Journal
+{
+
+private:
+
+    /** File path */
+    std::string path_;
+    /** File descriptor, -1 if closed */
+    int fd_;
+    /** Mapped header */
+    JournalHeader *header_;
+    /** Mapped window of records */
+    JournalRecord *window_;
+    /** Index of the mapped window */
+    size_t window_index_;
+    /** Number of records */
+    size_t count_;
+
+public:
+
+    /**
+     * @brief      Constructs a closed journal.
+     */
+    Journal() : fd_(-1), header_(nullptr), window_(nullptr),
+        window_index_(0), count_(0) {}
+
+    /**
+     * @brief      Destroys the journal, syncing it to disk.
+     */
+    ~Journal() { close(); }
+
+    Journal(const Journal &) = delete;
+    Journal & operator=(const Journal &) = delete;
+
+    /**
+     * @brief      Opens a journal for appending, creating it if needed.
+     *
+     * Existing journals are appended to after their last valid record.
+     *
+     * @param[in]  path           The file path
+     * @param[in]  nodes          The number of nodes, recorded on creation
+     * @param[in]  sample_period  The sampling period (s), recorded on creation
+     *
+     * @return     True on success, false otherwise.
+     */
+    bool open(const std::string & path, size_t nodes, float sample_period);
+
+    /**
+     * @brief      Syncs and closes the journal, trimming unused space.
+     */
+    void close();
+
+    /**
+     * @brief      Continues the journal in a new, empty file.
+     *
+     * The current file is closed and kept as its path with the
+     * JOURNAL_PREVIOUS suffix, replacing any former one.
+     *
+     * @return     True on success, false otherwise.
+     */
+    bool rotate();
+
+    /**
+     * @brief      Checks whether the journal is open.
+     *
+     * @return     True if open, false otherwise.
+     */
+    bool isOpen() const { return fd_ != -1; }
+
+    /**
+     * @brief      Gets the number of records.
+     *
+     * @return     The size.
+     */
+    size_t size() const { return count_; }
+
+    /**
+     * @brief      Appends a record, flagging it valid.
+     *
+     * @param[in]  record  The record
+     *
+     * @return     True on success, false if the journal could not grow.
+     */
+    bool append(const JournalRecord & record);
+
+    /**
+     * @brief      Appends a reset marker.
+     *
+     * @param[in]  epoch  The reset time (ms since the Unix epoch)
+     *
+     * @return     True on success, false otherwise.
+     */
+    bool appendReset(unsigned long epoch);
+
+    /**
+     * @brief      Flushes every appended record to disk.
+     *
+     * Blocks until written back, so it should not run on the ingest path.
+     * Records flushed are then marked synced in the header, so that
+     * recovery need not scan them again.
+     */
+    void sync();
+
+private:
+
+    /**
+     * @brief      Maps a window of records, allocating it in the file.
+     *
+     * @param[in]  index  The window index
+     *
+     * @return     True on success, false otherwise.
+     */
+    bool mapWindow(size_t index);
+};
+
+/**
+ * @brief      Class for a read-only view of a journal.
+ *
+ * Maps the window of JOURNAL_CHUNK holding the record accessed, so records
+ * returned remain valid only until another window is accessed. Not
+ * thread-safe; concurrent readers should each open their own view.
+ */
+class JournalReader
+{
+
+public:
+
+    /** Records per mapped window */
+    static const size_t WINDOW_RECORDS = JOURNAL_CHUNK / sizeof(JournalRecord);
+
+private:
+
+    /** Record returned when its window cannot be mapped, not flagged valid */
+    static const JournalRecord EMPTY;
+
+    /** File descriptor, -1 if closed */
+    int fd_;
+    /** Header */
+    JournalHeader header_;
+    /** Number of valid records */
+    size_t count_;
+    /** Mapped window of records, or null */
+    mutable const JournalRecord *window_;
+    /** Index of the mapped window */
+    mutable size_t window_index_;
+
+public:
+
+    /**
+     * @brief      Constructs a closed reader.
+     */
+    JournalReader() : fd_(-1), count_(0), window_(nullptr), window_index_(0) {}
+
+    /**
+     * @brief      Destroys the reader.
+     */
+    ~JournalReader() { close(); }
+
+    JournalReader(const JournalReader &) = delete;
+    JournalReader & operator=(const JournalReader &) = delete;
+
+    /**
+     * @brief      Opens a journal.
+     *
+     * @param[in]  path  The file path
+     *
+     * @return     True on success, false if missing or invalid.
+     */
+    bool open(const std::string & path);
+
+    /**
+     * @brief      Opens another view of an open journal.
+     *
+     * @param[in]  other  The reader of the journal
+     *
+     * @return     True on success, false otherwise.
+     */
+    bool open(const JournalReader & other);
+
+    /**
+     * @brief      Closes the journal.
+     */
+    void close();
+
+    /**
+     * @brief      Checks whether the reader is open.
+     *
+     * @return     True if open, false otherwise.
+     */
+    bool isOpen() const { return fd_ != -1; }
+
+    /**
+     * @brief      Gets the header.
+     *
+     * @return     The header.
+     */
+    const JournalHeader & header() const { return header_; }
+
+    /**
+     * @brief      Gets the number of valid records.
+     *
+     * @return     The size.
+     */
+    size_t size() const { return count_; }
+
+    /**
+     * @brief      Gets a record, mapping its window if needed.
+     *
+     * @param[in]  i     The record index
+     *
+     * @return     The record, not flagged valid if it could not be mapped.
+     */
+    const JournalRecord & operator[](size_t i) const
+    {
+        if ((!window_ || i / WINDOW_RECORDS != window_index_) &&
+            !mapWindow(i / WINDOW_RECORDS))
+        {
+            return EMPTY;
+        }
+        return window_[i % WINDOW_RECORDS];
+    }
+
+private:
+
+    /**
+     * @brief      Maps a window of records.
+     *
+     * @param[in]  index  The window index
+     *
+     * @return     True on success, false otherwise.
+     */
+    bool mapWindow(size_t index) const;
+};
+
+#endif
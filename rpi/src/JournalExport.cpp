@@ -0,0 +1,476 @@
+/**
+ * @file    rpi/src/JournalExport.cpp
+ *
+ * @brief   Journal export implementation
+ *
+ * Converts a range of journal records into one file per node, with the
+ * columns timestamp, lux, duty cycle, lux reference, comfort error and
+ * comfort variance, either as CSV or as typed binary columns, both read by
+ * the MATLAB analysis scripts. Comfort metrics are replayed from the
+ * journaled samples, restarting at each reset. Journal records never change
+ * once appended, so a range is a consistent snapshot, exported while
+ * ingestion continues.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#include "JournalExport.hpp"
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "debug.hpp"
+#include "constants.hpp"
+#include "Metrics.hpp"
+
+static_assert(sizeof(ColumnField) == 32, "Column fields must be packed");
+static_assert(sizeof(ColumnHeader) <= ColumnHeader::SIZE, "Column header too large");
+
+const char ColumnHeader::MAGIC[8] = {'S', 'C', 'D', 'T', 'R', 'C', 'O', 'L'};
+
+namespace
+{
+    /** Longest formatted CSV line (bytes) */
+    const size_t LINE_MAX_LENGTH = 128;
+    /** Records processed between progress updates */
+    const size_t PROGRESS_STEP = 4096;
+
+    /** Exported columns, in CSV order */
+    const ColumnField COLUMNS[] = {
+        {"timestamp",         JournalField::TYPE_U64, 0},
+        {"lux",               JournalField::TYPE_F32, 0},
+        {"duty_cycle",        JournalField::TYPE_F32, 0},
+        {"lux_reference",     JournalField::TYPE_F32, 0},
+        {"comfort_error",     JournalField::TYPE_F64, 0},
+        {"comfort_variance",  JournalField::TYPE_F64, 0}
+    };
+    /** Number of exported columns */
+    const size_t COLUMN_COUNT = sizeof(COLUMNS) / sizeof(COLUMNS[0]);
+    static_assert(COLUMN_COUNT <= ColumnHeader::MAX_COLUMNS, "Too many columns");
+
+    /**
+     * @brief      Class for an exported entry.
+     */
+    class Row
+    {
+
+    public:
+
+        /** Timestamp (ms) */
+        uint64_t timestamp;
+        /** Measured illuminance */
+        float lux;
+        /** Duty cycle */
+        float duty_cycle;
+        /** Reference illuminance */
+        float lux_reference;
+        /** Comfort error */
+        double comfort_error;
+        /** Comfort variance */
+        double comfort_variance;
+    };
+
+    /**
+     * @brief      Writes a whole buffer at an offset, or at the end of file.
+     *
+     * @param[in]  fd      The file descriptor
+     * @param[in]  data    The data
+     * @param[in]  length  The length (bytes)
+     * @param[in]  offset  The file offset, or -1 to append
+     *
+     * @return     True on success, false otherwise.
+     */
+    bool writeAll(int fd, const char *data, size_t length, off_t offset = -1)
+    {
+        size_t written = 0;
+        while (written < length)
+        {
+            ssize_t n = (offset < 0)?
+                ::write(fd, data + written, length - written) :
+                ::pwrite(fd, data + written, length - written, offset + written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            written += n;
+        }
+        return true;
+    }
+
+    /**
+     * @brief      Class for a node's output file, written in large blocks.
+     */
+    class NodeOutput
+    {
+
+    public:
+
+        /** File descriptor, -1 if not open */
+        int fd;
+        /** Comfort metrics of the node */
+        Metrics metrics;
+
+        /**
+         * @brief      Constructs a closed output.
+         */
+        NodeOutput() : fd(-1) {}
+
+        /**
+         * @brief      Destroys the output, closing its file.
+         */
+        virtual ~NodeOutput() { if (fd != -1) ::close(fd); }
+
+        /**
+         * @brief      Creates the output file.
+         *
+         * @param[in]  path  The file path, without extension
+         * @param[in]  rows  The number of rows to be written
+         *
+         * @return     True on success, false otherwise.
+         */
+        virtual bool open(const std::string & path, size_t rows) = 0;
+
+        /**
+         * @brief      Appends a row.
+         *
+         * @param[in]  row   The row
+         *
+         * @return     True on success, false otherwise.
+         */
+        virtual bool append(const Row & row) = 0;
+
+        /**
+         * @brief      Writes the pending rows.
+         *
+         * @return     True on success, false otherwise.
+         */
+        virtual bool flush() = 0;
+
+    protected:
+
+        /**
+         * @brief      Creates a file, truncating it.
+         *
+         * @param[in]  filename  The filename
+         *
+         * @return     True on success, false otherwise.
+         */
+        bool create(const std::string & filename)
+        {
+            fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd == -1)
+            {
+                errPrintTrace("Could not write " << filename << ": " << strerror(errno));
+                return false;
+            }
+            return true;
+        }
+    };
+
+    /**
+     * @brief      Class for a node's CSV output.
+     */
+    class CsvOutput : public NodeOutput
+    {
+
+    private:
+
+        /** Pending text */
+        std::vector< char > buffer_;
+        /** Length of the pending text */
+        size_t length_;
+
+    public:
+
+        CsvOutput() : length_(0) {}
+
+        bool open(const std::string & path, size_t)
+        {
+            buffer_.resize(EXPORT_BLOCK + LINE_MAX_LENGTH);
+            return create(path + ".csv");
+        }
+
+        bool append(const Row & row)
+        {
+            length_ += snprintf(buffer_.data() + length_, LINE_MAX_LENGTH,
+                "%lu,%g,%g,%g,%g,%g\n",
+                (unsigned long) row.timestamp,
+                row.lux,
+                row.duty_cycle,
+                row.lux_reference,
+                row.comfort_error,
+                row.comfort_variance);
+            return (length_ < EXPORT_BLOCK) || flush();
+        }
+
+        bool flush()
+        {
+            bool ok = writeAll(fd, buffer_.data(), length_);
+            length_ = 0;
+            return ok;
+        }
+    };
+
+    /**
+     * @brief      Class for a node's columnar output.
+     *
+     * The row count is known upfront, so every column has a fixed place in
+     * the file and is buffered separately, written at its own offset.
+     */
+    class ColumnOutput : public NodeOutput
+    {
+
+    private:
+
+        /**
+         * @brief      Class for a column being written.
+         */
+        class Column
+        {
+
+        public:
+
+            /** Pending values */
+            std::vector< char > buffer;
+            /** Length of the pending values (bytes) */
+            size_t length;
+            /** File offset of the pending values */
+            off_t offset;
+        };
+
+        /** Columns, in header order */
+        Column columns_[COLUMN_COUNT];
+
+        /**
+         * @brief      Buffers a value in a column.
+         *
+         * @param[in]  index  The column index
+         * @param[in]  value  The value
+         *
+         * @tparam     T      The value type, matching the column type
+         *
+         * @return     True on success, false otherwise.
+         */
+        template < typename T >
+        bool push(size_t index, const T & value)
+        {
+            Column & column = columns_[index];
+            std::memcpy(column.buffer.data() + column.length, &value, sizeof(T));
+            column.length += sizeof(T);
+            return (column.length < column.buffer.size()) || flushColumn(column);
+        }
+
+        /**
+         * @brief      Writes a column's pending values.
+         *
+         * @param      column  The column
+         *
+         * @return     True on success, false otherwise.
+         */
+        bool flushColumn(Column & column)
+        {
+            bool ok = writeAll(fd, column.buffer.data(), column.length, column.offset);
+            column.offset += column.length;
+            column.length = 0;
+            return ok;
+        }
+
+    public:
+
+        bool open(const std::string & path, size_t rows)
+        {
+            if (!create(path + ".col")) return false;
+
+            ColumnHeader header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, ColumnHeader::MAGIC, sizeof(ColumnHeader::MAGIC));
+            header.version = ColumnHeader::VERSION;
+            header.header_size = ColumnHeader::SIZE;
+            header.columns = COLUMN_COUNT;
+            header.rows = rows;
+
+            // Blocks hold whole values, and add up to EXPORT_BLOCK per node
+            uint64_t offset = ColumnHeader::SIZE;
+            size_t block = EXPORT_BLOCK / COLUMN_COUNT / sizeof(double) * sizeof(double);
+            for (size_t i = 0; i < COLUMN_COUNT; i++)
+            {
+                header.fields[i] = COLUMNS[i];
+                header.fields[i].offset = offset;
+                size_t width = (COLUMNS[i].type == JournalField::TYPE_F32)?
+                    sizeof(float) : sizeof(uint64_t);
+                columns_[i].buffer.resize(block / width * width);
+                columns_[i].length = 0;
+                columns_[i].offset = offset;
+                offset += rows * width;
+            }
+
+            std::vector< char > padded(ColumnHeader::SIZE, 0);
+            std::memcpy(padded.data(), &header, sizeof(header));
+            return writeAll(fd, padded.data(), padded.size(), 0);
+        }
+
+        bool append(const Row & row)
+        {
+            return push(0, row.timestamp) &&
+                push(1, row.lux) &&
+                push(2, row.duty_cycle) &&
+                push(3, row.lux_reference) &&
+                push(4, row.comfort_error) &&
+                push(5, row.comfort_variance);
+        }
+
+        bool flush()
+        {
+            bool ok = true;
+            for (Column & column : columns_) ok = flushColumn(column) && ok;
+            return ok;
+        }
+    };
+
+    /**
+     * @brief      Opens a node's output, unless already open.
+     *
+     * @param      outputs    The outputs, by node
+     * @param[in]  id         The node identifier
+     * @param[in]  directory  The output directory
+     * @param[in]  columns    Whether to write columnar files instead of CSV
+     * @param[in]  rows       The row counts of columnar files, by node
+     *
+     * @return     True on success, false otherwise.
+     */
+    bool openOutput(std::vector< std::unique_ptr< NodeOutput > > & outputs, size_t id,
+        const std::string & directory, bool columns, const std::vector< size_t > & rows)
+    {
+        if (id >= outputs.size()) outputs.resize(id + 1);
+        std::unique_ptr< NodeOutput > & output = outputs[id];
+        if (output) return true;
+
+        if (columns) output.reset(new ColumnOutput());
+        else output.reset(new CsvOutput());
+        return output->open(directory + "/" + std::to_string(id),
+            (id < rows.size())? rows[id] : 0);
+    }
+}
+
+size_t ExportJob::sessionStart(const JournalReader & journal, size_t end)
+{
+    for (size_t i = std::min(end, journal.size()); i > 0; i--)
+    {
+        if (journal[i - 1].flags & JournalRecord::FLAG_RESET) return i - 1;
+    }
+    return 0;
+}
+
+bool ExportJob::open()
+{
+    return reader_.open(journal_);
+}
+
+bool ExportJob::run()
+{
+    state_ = RUNNING;
+
+    JournalReader & journal = reader_;
+    if (!journal.isOpen() && !open())
+    {
+        errPrintTrace("Could not read journal " << journal_);
+        state_ = FAILED;
+        return false;
+    }
+    const float sample_period = journal.header().sample_period;
+    size_t last = std::min(last_, journal.size());
+
+    // Columnar files are laid out by their row counts
+    std::vector< size_t > rows;
+    if (format_ == COLUMNS)
+    {
+        for (size_t i = first_; i < last; i++)
+        {
+            const JournalRecord & r = journal[i];
+            if (!(r.flags & JournalRecord::FLAG_VALID) ||
+                (r.flags & JournalRecord::FLAG_RESET)) continue;
+            if (r.id >= rows.size()) rows.resize(r.id + 1, 0);
+            rows[r.id]++;
+        }
+    }
+
+    // Every node gets a file, empty if it has no records in the range
+    std::vector< std::unique_ptr< NodeOutput > > outputs;
+    bool ok = true;
+    for (size_t id = 0; id < journal.header().nodes && ok; id++)
+    {
+        ok = openOutput(outputs, id, directory_, format_ == COLUMNS, rows);
+    }
+
+    unsigned long origin = 0, offset = 0;
+    bool started = false;
+    size_t exported = 0;
+    Row row;
+
+    for (size_t i = first_; i < last && ok; i++)
+    {
+        const JournalRecord & r = journal[i];
+        if ((i - first_) % PROGRESS_STEP == 0)
+        {
+            processed_ = i - first_;
+            exported_ = exported;
+        }
+        if (!(r.flags & JournalRecord::FLAG_VALID))
+        {
+            errPrintTrace("Could not read journal record " << i);
+            ok = false;
+            break;
+        }
+        if (r.flags & JournalRecord::FLAG_RESET)
+        {
+            // Sessions are timed from their reset, rebased onto the first
+            if (!started) origin = r.timestamp;
+            started = true;
+            offset = r.timestamp - origin;
+            for (std::unique_ptr< NodeOutput > & output : outputs)
+            {
+                if (output) output->metrics.reset();
+            }
+            continue;
+        }
+
+        if (!openOutput(outputs, r.id, directory_, format_ == COLUMNS, rows))
+        {
+            ok = false;
+            break;
+        }
+        std::unique_ptr< NodeOutput > & output = outputs[r.id];
+
+        Metrics & m = output->metrics;
+        m.update(r.timestamp, r.lux, r.duty_cycle, r.lux_reference);
+        row.timestamp = offset + r.timestamp;
+        row.lux = r.lux;
+        row.duty_cycle = r.duty_cycle;
+        row.lux_reference = r.lux_reference;
+        row.comfort_error = m.comfortError();
+        row.comfort_variance = m.comfortVariance(sample_period);
+        ok = output->append(row);
+        exported++;
+    }
+
+    for (std::unique_ptr< NodeOutput > & output : outputs)
+    {
+        if (output && output->fd != -1) ok = output->flush() && ok;
+    }
+    outputs.clear();
+    journal.close();
+
+    if (!ok)
+    {
+        errPrintTrace("Export to " << directory_ << " failed");
+    }
+    processed_ = last_ - first_;
+    exported_ = exported;
+    state_ = (ok)? DONE : FAILED;
+    return ok;
+}
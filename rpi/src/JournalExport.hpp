@@ -0,0 +1,217 @@
+/**
+ * @file    rpi/src/JournalExport.hpp
+ *
+ * @brief   Journal export headers
+ *
+ * Converts a range of journal records into one file per node, with the
+ * columns timestamp, lux, duty cycle, lux reference, comfort error and
+ * comfort variance, either as CSV or as typed binary columns, both read by
+ * the MATLAB analysis scripts. Comfort metrics are replayed from the
+ * journaled samples, restarting at each reset. Journal records never change
+ * once appended, so a range is a consistent snapshot, exported while
+ * ingestion continues.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#ifndef JOURNAL_EXPORT_HPP
+#define JOURNAL_EXPORT_HPP
+
+#include <cstdint>
+#include <string>
+#include <atomic>
+#include <boost/shared_ptr.hpp>
+
+#include "Journal.hpp"
+
+/**
+ * @brief      Class for a column description.
+ */
+class ColumnField
+{
+
+public:
+
+    /** Column name, null-terminated */
+    char name[20];
+    /** Column type */
+    JournalField::Type type;
+    /** Offset of the column data within the file (bytes) */
+    uint64_t offset;
+};
+
+/**
+ * @brief      Class for the columnar export file header.
+ *
+ * Files hold the header, then each column's values contiguously, little
+ * endian, so that a reader loads a column with a single read.
+ */
+class ColumnHeader
+{
+
+public:
+
+    /** File identifier */
+    static const char MAGIC[8];
+    /** Format version */
+    static const uint32_t VERSION = 1;
+    /** Space reserved for the header, columns start after it (bytes) */
+    static const size_t SIZE = 256;
+    /** Maximum number of described columns */
+    static const size_t MAX_COLUMNS = 6;
+
+    /** File identifier */
+    char magic[8];
+    /** Format version */
+    uint32_t version;
+    /** Header size (bytes) */
+    uint32_t header_size;
+    /** Number of columns */
+    uint32_t columns;
+    /** Reserved, zero */
+    uint32_t reserved;
+    /** Number of rows */
+    uint64_t rows;
+    /** Column descriptions */
+    ColumnField fields[MAX_COLUMNS];
+};
+
+/**
+ * @brief      Class for an export of journal records.
+ *
+ * Runs on one thread, while others may poll its progress.
+ */
+class ExportJob
+{
+
+public:
+
+    /** Export job shared pointer public type definition */
+    typedef boost::shared_ptr< ExportJob > ptr;
+
+    /** Export states */
+    enum State
+    {
+        PENDING = 0,
+        RUNNING,
+        DONE,
+        FAILED
+    };
+
+    /** Output formats */
+    enum Format
+    {
+        /** Text, one file per node named <id>.csv */
+        CSV = 0,
+        /** Typed columns, one file per node named <id>.col */
+        COLUMNS
+    };
+
+private:
+
+    /** Journal file path */
+    std::string journal_;
+    /** Journal, once opened */
+    JournalReader reader_;
+    /** Output directory */
+    std::string directory_;
+    /** Output format */
+    Format format_;
+    /** First record to export */
+    size_t first_;
+    /** End of the records to export */
+    size_t last_;
+    /** Current state */
+    std::atomic< int > state_;
+    /** Number of records processed */
+    std::atomic< size_t > processed_;
+    /** Number of entries written */
+    std::atomic< size_t > exported_;
+
+public:
+
+    /**
+     * @brief      Constructs an export job.
+     *
+     * @param[in]  journal    The journal file path
+     * @param[in]  directory  The output directory
+     * @param[in]  first      The first record to export
+     * @param[in]  last       The end of the records to export
+     * @param[in]  format     The output format
+     */
+    ExportJob(
+        const std::string & journal,
+        const std::string & directory,
+        size_t first,
+        size_t last,
+        Format format = CSV)
+        : journal_(journal),
+          directory_(directory),
+          format_(format),
+          first_(first),
+          last_(last),
+          state_(PENDING),
+          processed_(0),
+          exported_(0) {}
+
+    /**
+     * @brief      Finds the start of the session preceding a record.
+     *
+     * @param[in]  journal  The journal
+     * @param[in]  end      The end of the records to search
+     *
+     * @return     The index of the latest reset marker, or 0 if none.
+     */
+    static size_t sessionStart(const JournalReader & journal, size_t end);
+
+    /**
+     * @brief      Opens the journal, ahead of running the export.
+     *
+     * Records are then read from the file opened, even if the journal is
+     * rotated in the meantime. Otherwise, the journal is opened on running.
+     *
+     * @return     True on success, false otherwise.
+     */
+    bool open();
+
+    /**
+     * @brief      Runs the export.
+     *
+     * @return     True on success, false otherwise.
+     */
+    bool run();
+
+    /**
+     * @brief      Gets the current state.
+     *
+     * @return     The state.
+     */
+    State state() const { return static_cast< State >(state_.load()); }
+
+    /**
+     * @brief      Gets the fraction of records processed.
+     *
+     * @return     The progress, in [0, 1].
+     */
+    float progress() const
+    {
+        return (last_ > first_)? (float) processed_.load() / (last_ - first_) : 1.0f;
+    }
+
+    /**
+     * @brief      Gets the number of entries written.
+     *
+     * @return     The number of entries.
+     */
+    size_t exported() const { return exported_.load(); }
+
+    /**
+     * @brief      Gets the output directory.
+     *
+     * @return     The directory.
+     */
+    const std::string & directory() const { return directory_; }
+};
+
+#endif
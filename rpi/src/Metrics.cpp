@@ -0,0 +1,77 @@
+/**
+ * @file    rpi/src/Metrics.cpp
+ *
+ * @brief   Incremental performance metrics implementation
+ *
+ * Keeps running accumulators for energy, comfort error and comfort variance,
+ * so that each metric is updated and queried in constant time. Metrics over
+ * a window are the difference between the accumulators at either end.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#include "Metrics.hpp"
+
+void Metrics::reset()
+{
+    count_ = 0;
+    energy_ = 0.0;
+    comfort_error_sum_ = 0.0;
+    comfort_variance_sum_ = 0.0;
+    t_prev_ = 0;
+    d_prev_ = 0.0;
+    lux_1_ = 0.0;
+    lux_2_ = 0.0;
+}
+
+void Metrics::update(
+    unsigned long timestamp,
+    float lux,
+    float duty_cycle,
+    float lux_reference)
+{
+    // Energy uses the previous duty cycle during the elapsed interval
+    if (count_ >= 1)
+    {
+        energy_ += d_prev_ * ((timestamp - t_prev_) / 1000.0);
+    }
+    // Comfort variance requires two previous samples
+    if (count_ >= 2)
+    {
+        comfort_variance_sum_ += std::abs(lux - 2 * lux_1_ + lux_2_);
+    }
+    comfort_error_sum_ += std::max(lux_reference - lux, 0.0f);
+
+    count_++;
+    t_prev_ = timestamp;
+    d_prev_ = duty_cycle;
+    lux_2_ = lux_1_;
+    lux_1_ = lux;
+}
+
+double Metrics::energy() const
+{
+    return energy_;
+}
+
+double Metrics::comfortError() const
+{
+    return (count_)? comfort_error_sum_ / count_ : 0.0;
+}
+
+double Metrics::comfortVariance(float sample_period) const
+{
+    return (count_)?
+        comfort_variance_sum_ / (count_ * std::pow(sample_period, 2)) : 0.0;
+}
+
+Metrics Metrics::since(const Metrics & before) const
+{
+    Metrics window(*this);
+    window.count_ -= before.count_;
+    window.energy_ -= before.energy_;
+    window.comfort_error_sum_ -= before.comfort_error_sum_;
+    window.comfort_variance_sum_ -= before.comfort_variance_sum_;
+    return window;
+}
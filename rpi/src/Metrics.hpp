@@ -0,0 +1,112 @@
+/**
+ * @file    rpi/src/Metrics.hpp
+ *
+ * @brief   Incremental performance metrics headers
+ *
+ * Keeps running accumulators for energy, comfort error and comfort variance,
+ * so that each metric is updated and queried in constant time. Metrics over
+ * a window are the difference between the accumulators at either end.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <cmath>
+#include <algorithm>
+
+/**
+ * @brief      Class for a node's running performance metrics.
+ */
+class Metrics
+{
+
+private:
+
+    /** Number of accumulated samples */
+    unsigned long count_;
+    /** Accumulated energy (J) */
+    double energy_;
+    /** Sum of positive reference tracking errors (lx) */
+    double comfort_error_sum_;
+    /** Sum of absolute second differences of illuminance (lx) */
+    double comfort_variance_sum_;
+
+    /** Timestamp of the previous sample (ms) */
+    unsigned long t_prev_;
+    /** Duty cycle of the previous sample */
+    float d_prev_;
+    /** Illuminance of the previous sample */
+    float lux_1_;
+    /** Illuminance of the sample before the previous one */
+    float lux_2_;
+
+public:
+
+    /**
+     * @brief      Constructs an empty set of metrics.
+     */
+    Metrics() { reset(); }
+
+    /**
+     * @brief      Clears the accumulators.
+     */
+    void reset();
+
+    /**
+     * @brief      Accumulates a new sample.
+     *
+     * @param[in]  timestamp      The timestamp (ms)
+     * @param[in]  lux            The lux
+     * @param[in]  duty_cycle     The duty cycle
+     * @param[in]  lux_reference  The lux reference
+     */
+    void update(
+        unsigned long timestamp,
+        float lux,
+        float duty_cycle,
+        float lux_reference);
+
+    /**
+     * @brief      Gets the number of accumulated samples.
+     *
+     * @return     The sample count.
+     */
+    unsigned long count() const { return count_; }
+
+    /**
+     * @brief      Gets the accumulated energy.
+     *
+     * @return     The energy (J).
+     */
+    double energy() const;
+
+    /**
+     * @brief      Gets the average comfort error.
+     *
+     * @return     The comfort error (lx).
+     */
+    double comfortError() const;
+
+    /**
+     * @brief      Gets the average comfort variance.
+     *
+     * @param[in]  sample_period  The sampling period (s)
+     *
+     * @return     The comfort variance (lx/s^2).
+     */
+    double comfortVariance(float sample_period) const;
+
+    /**
+     * @brief      Gets the metrics accumulated since an earlier state.
+     *
+     * @param[in]  before  The earlier metrics, of the same sample sequence
+     *
+     * @return     The metrics of the samples accumulated after before.
+     */
+    Metrics since(const Metrics & before) const;
+};
+
+#endif
@@ -0,0 +1,166 @@
+/**
+ * @file    rpi/src/Query.cpp
+ *
+ * @brief   History query implementation
+ *
+ * Filters and aggregates a variable of the stored entries over a period,
+ * grouped by time bucket. Filters are ranges of quantised values, evaluated
+ * into a selection mask over column spans, and aggregates are masked
+ * reductions over the same spans, so that a query is a sequence of
+ * branchless column scans.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#include "Query.hpp"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "kernels.hpp"
+
+QueryCondition Query::compare(History::Column column, Operator op, float value)
+{
+    // Threshold in quantised units, snapped when within rounding error
+    double q = value / History::STEPS[column];
+    if (std::abs(q - std::round(q)) < 1e-3) q = std::round(q);
+    double lo = 0, hi = UINT16_MAX;
+    switch (op)
+    {
+        case OP_LESS:          hi = std::ceil(q) - 1;  break;
+        case OP_LESS_EQUAL:    hi = std::floor(q);     break;
+        case OP_GREATER:       lo = std::floor(q) + 1; break;
+        case OP_GREATER_EQUAL: lo = std::ceil(q);      break;
+        case OP_EQUAL:         lo = std::ceil(q); hi = std::floor(q); break;
+    }
+
+    QueryCondition condition;
+    condition.column = column;
+    if (lo > hi || hi < 0 || lo > UINT16_MAX)
+    {
+        // Nothing may match
+        condition.lo = 1;
+        condition.hi = 0;
+    }
+    else
+    {
+        condition.lo = (uint16_t) std::max(lo, 0.0);
+        condition.hi = (uint16_t) std::min(hi, (double) UINT16_MAX);
+    }
+    return condition;
+}
+
+size_t Query::buckets() const
+{
+    if (end < start) return 0;
+    return (bucket)? (end - start) / bucket + 1 : 1;
+}
+
+void Query::scan(const History & history, const Archive & archive,
+    std::vector< QueryBucket > & buckets) const
+{
+    // Cold entries are decoded, then scanned as the history is
+    uint32_t offsets[CHUNK];
+    uint16_t values[History::COLUMNS][CHUNK];
+    const uint16_t *columns[History::COLUMNS];
+    for (int col = 0; col < History::COLUMNS; col++) columns[col] = values[col];
+    unsigned long base = 0;
+    size_t n = 0;
+    archive.forEachEntry(start, end,
+        [&](const Entry & e){
+            if (n == CHUNK ||
+                (n && e.timestamp - base > std::numeric_limits< uint32_t >::max()))
+            {
+                scanChunk(base, offsets, columns, n, buckets);
+                n = 0;
+            }
+            if (n == 0) base = e.timestamp;
+            offsets[n] = e.timestamp - base;
+            values[History::COL_LUX][n] = History::quantise(History::COL_LUX, e.lux);
+            values[History::COL_DUTY_CYCLE][n] =
+                History::quantise(History::COL_DUTY_CYCLE, e.duty_cycle);
+            values[History::COL_LUX_REFERENCE][n] =
+                History::quantise(History::COL_LUX_REFERENCE, e.lux_reference);
+            values[History::COL_OCCUPANCY][n] = e.occupancy;
+            n++;
+        });
+    if (n) scanChunk(base, offsets, columns, n, buckets);
+
+    history.forEachChunk(history.lowerBound(start), history.upperBound(end), CHUNK,
+        [&](unsigned long base, const uint32_t *offsets,
+            const uint16_t * const *columns, size_t n){
+            scanChunk(base, offsets, columns, n, buckets);
+        });
+}
+
+void Query::scanChunk(
+    unsigned long base,
+    const uint32_t *offsets,
+    const uint16_t * const *columns,
+    size_t n,
+    std::vector< QueryBucket > & buckets) const
+{
+    uint8_t mask[CHUNK];
+    std::fill(mask, mask + n, 1);
+    for (const QueryCondition & c : conditions)
+    {
+        Kernels::selectRange(columns[c.column], n, c.lo, c.hi, mask);
+    }
+
+    // Entries are sorted, so each bucket is a run found by binary search
+    const uint16_t *x = columns[column];
+    size_t i = 0;
+    while (i < n)
+    {
+        unsigned long t = base + offsets[i];
+        size_t k = (bucket)? (t - start) / bucket : 0;
+        size_t j = n;
+        if (bucket)
+        {
+            unsigned long next = start + (k + 1) * bucket - base;
+            if (next <= std::numeric_limits< uint32_t >::max())
+            {
+                j = std::lower_bound(offsets + i, offsets + n, (uint32_t) next) - offsets;
+            }
+        }
+        if (k < buckets.size())
+        {
+            QueryBucket & b = buckets[k];
+            size_t count = Kernels::countSelected(mask + i, j - i);
+            if (count)
+            {
+                b.count += count;
+                if (aggregate == AGG_AVG || aggregate == AGG_SUM)
+                {
+                    b.sum += Kernels::maskedSum(x + i, mask + i, j - i);
+                }
+                else if (aggregate == AGG_MIN)
+                {
+                    b.min = std::min(b.min, Kernels::maskedMinimum(x + i, mask + i, j - i));
+                }
+                else if (aggregate == AGG_MAX)
+                {
+                    b.max = std::max(b.max, Kernels::maskedMaximum(x + i, mask + i, j - i));
+                }
+            }
+        }
+        i = j;
+    }
+}
+
+double Query::value(const QueryBucket & b) const
+{
+    if (aggregate == AGG_COUNT) return b.count;
+    if (b.count == 0) return std::numeric_limits< double >::quiet_NaN();
+    double step = History::STEPS[column];
+    switch (aggregate)
+    {
+        case AGG_AVG: return b.sum * step / b.count;
+        case AGG_MIN: return b.min * step;
+        case AGG_MAX: return b.max * step;
+        case AGG_SUM: return b.sum * step;
+        default:      return b.count;
+    }
+}
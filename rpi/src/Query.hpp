@@ -0,0 +1,189 @@
+/**
+ * @file    rpi/src/Query.hpp
+ *
+ * @brief   History query headers
+ *
+ * Filters and aggregates a variable of the stored entries over a period,
+ * grouped by time bucket. Filters are ranges of quantised values, evaluated
+ * into a selection mask over column spans, and aggregates are masked
+ * reductions over the same spans, so that a query is a sequence of
+ * branchless column scans.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#ifndef QUERY_HPP
+#define QUERY_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "History.hpp"
+#include "Archive.hpp"
+
+/**
+ * @brief      Class for a query filter, over a column's quantised values.
+ */
+class QueryCondition
+{
+
+public:
+
+    /** Filtered column */
+    History::Column column;
+    /** Lowest selected quantised value */
+    uint16_t lo;
+    /** Highest selected quantised value, below lo if none */
+    uint16_t hi;
+};
+
+/**
+ * @brief      Class for the aggregates of a query bucket.
+ */
+class QueryBucket
+{
+
+public:
+
+    /** Number of selected entries */
+    size_t count;
+    /** Sum of the selected quantised values */
+    uint64_t sum;
+    /** Minimum selected quantised value */
+    uint16_t min;
+    /** Maximum selected quantised value */
+    uint16_t max;
+
+    /**
+     * @brief      Constructs an empty bucket.
+     */
+    QueryBucket() : count(0), sum(0), min(UINT16_MAX), max(0) {}
+};
+
+/**
+ * @brief      Class for a history query.
+ */
+class Query
+{
+
+public:
+
+    /** Aggregate functions */
+    enum Aggregate
+    {
+        AGG_AVG = 0,
+        AGG_MIN,
+        AGG_MAX,
+        AGG_SUM,
+        AGG_COUNT
+    };
+
+    /** Comparison operators */
+    enum Operator
+    {
+        OP_LESS = 0,
+        OP_LESS_EQUAL,
+        OP_GREATER,
+        OP_GREATER_EQUAL,
+        OP_EQUAL
+    };
+
+    /** Maximum number of entries scanned at once */
+    static const size_t CHUNK = 1024;
+
+    /** Aggregate function */
+    Aggregate aggregate;
+    /** Aggregated column */
+    History::Column column;
+    /** Queried nodes */
+    std::vector< size_t > nodes;
+    /** Period start timestamp */
+    unsigned long start;
+    /** Period end timestamp, inclusive */
+    unsigned long end;
+    /** Bucket length (ms), 0 for a single bucket over the period */
+    unsigned long bucket;
+    /** Filters, all of which must hold */
+    std::vector< QueryCondition > conditions;
+
+    /**
+     * @brief      Constructs a query of the average lux over no nodes.
+     */
+    Query()
+        : aggregate(AGG_AVG),
+          column(History::COL_LUX),
+          start(0),
+          end(0),
+          bucket(0) {}
+
+    /**
+     * @brief      Builds a filter comparing a column with a value.
+     *
+     * @param[in]  column  The column
+     * @param[in]  op      The operator
+     * @param[in]  value   The value
+     *
+     * @return     The condition, over quantised values.
+     */
+    static QueryCondition compare(History::Column column, Operator op, float value);
+
+    /**
+     * @brief      Gets the number of buckets over the period.
+     *
+     * @return     The number of buckets.
+     */
+    size_t buckets() const;
+
+    /**
+     * @brief      Gets the start timestamp of a bucket.
+     *
+     * @param[in]  i     The bucket index
+     *
+     * @return     The timestamp.
+     */
+    unsigned long bucketStart(size_t i) const
+    {
+        return (bucket)? start + i * bucket : start;
+    }
+
+    /**
+     * @brief      Aggregates a node's entries over the period.
+     *
+     * @param[in]  history  The node's history
+     * @param[in]  archive  The node's cold log, older than the history
+     * @param      buckets  The buckets, of size buckets()
+     */
+    void scan(const History & history, const Archive & archive,
+        std::vector< QueryBucket > & buckets) const;
+
+    /**
+     * @brief      Gets a bucket's aggregate value.
+     *
+     * @param[in]  b     The bucket
+     *
+     * @return     The value, NaN if no entry was selected.
+     */
+    double value(const QueryBucket & b) const;
+
+private:
+
+    /**
+     * @brief      Aggregates a span of entries within the period.
+     *
+     * @param[in]  base     The timestamp the offsets are relative to
+     * @param[in]  offsets  The timestamp offsets, sorted
+     * @param[in]  columns  The quantised columns
+     * @param[in]  n        The number of entries, at most CHUNK
+     * @param      buckets  The buckets
+     */
+    void scanChunk(
+        unsigned long base,
+        const uint32_t *offsets,
+        const uint16_t * const *columns,
+        size_t n,
+        std::vector< QueryBucket > & buckets) const;
+};
+
+#endif
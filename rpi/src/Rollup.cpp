@@ -0,0 +1,87 @@
+/**
+ * @file    rpi/src/Rollup.cpp
+ *
+ * @brief   Multi-resolution log rollup implementation
+ *
+ * Downsamples a node's lux and duty cycle into 1 s, 10 s and 1 min buckets
+ * as entries are inserted, so that long-range trends can be queried without
+ * scanning raw entries.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#include "Rollup.hpp"
+
+const unsigned long Rollup::WIDTHS[TIERS] = {1000, 10000, 60000};
+
+Rollup::Rollup()
+{
+    tiers_[0] = SegmentedBuffer< Bucket >(ROLLUP_1S_CAPACITY);
+    tiers_[1] = SegmentedBuffer< Bucket >(ROLLUP_10S_CAPACITY);
+    tiers_[2] = SegmentedBuffer< Bucket >(ROLLUP_1MIN_CAPACITY);
+}
+
+void Rollup::clear()
+{
+    for (size_t tier = 0; tier < TIERS; tier++)
+    {
+        tiers_[tier].clear();
+    }
+}
+
+void Rollup::push_back(unsigned long timestamp, float lux, float duty_cycle)
+{
+    float values[Bucket::VARIABLES] = {lux, duty_cycle};
+
+    for (size_t tier = 0; tier < TIERS; tier++)
+    {
+        SegmentedBuffer< Bucket > & buckets = tiers_[tier];
+        unsigned long start = timestamp - timestamp % WIDTHS[tier];
+
+        if (buckets.empty() || buckets[buckets.size() - 1].start != start)
+        {
+            Bucket bucket;
+            bucket.start = start;
+            bucket.count = 1;
+            for (int v = 0; v < Bucket::VARIABLES; v++)
+            {
+                bucket.min[v] = bucket.max[v] = bucket.last[v] = values[v];
+                bucket.sum[v] = values[v];
+            }
+            buckets.push_back(bucket);
+        }
+        else
+        {
+            Bucket & bucket = buckets[buckets.size() - 1];
+            bucket.count++;
+            for (int v = 0; v < Bucket::VARIABLES; v++)
+            {
+                bucket.min[v] = std::min(bucket.min[v], values[v]);
+                bucket.max[v] = std::max(bucket.max[v], values[v]);
+                bucket.sum[v] += values[v];
+                bucket.last[v] = values[v];
+            }
+        }
+    }
+}
+
+size_t Rollup::select(unsigned long resolution)
+{
+    size_t tier = TIERS;
+    while (tier > 0 && WIDTHS[tier - 1] > resolution) tier--;
+    return (tier == 0)? TIERS : tier - 1;
+}
+
+size_t Rollup::lowerBound(size_t tier, unsigned long t) const
+{
+    const SegmentedBuffer< Bucket > & buckets = tiers_[tier];
+    size_t first = 0, last = buckets.size();
+    while (first < last)
+    {
+        size_t mid = first + (last - first) / 2;
+        if (buckets[mid].start + WIDTHS[tier] <= t) first = mid + 1;
+        else                                        last = mid;
+    }
+    return first;
+}
@@ -0,0 +1,154 @@
+/**
+ * @file    rpi/src/Rollup.hpp
+ *
+ * @brief   Multi-resolution log rollup headers
+ *
+ * Downsamples a node's lux and duty cycle into 1 s, 10 s and 1 min buckets
+ * as entries are inserted, so that long-range trends can be queried without
+ * scanning raw entries.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#ifndef ROLLUP_HPP
+#define ROLLUP_HPP
+
+#include "SegmentedBuffer.hpp"
+#include "constants.hpp"
+
+/**
+ * @brief      Class for a rollup bucket.
+ */
+class Bucket
+{
+
+public:
+
+    /** Rolled up variables */
+    enum Variable
+    {
+        VAR_LUX = 0,
+        VAR_DUTY_CYCLE,
+        VARIABLES
+    };
+
+    /** Bucket start timestamp */
+    unsigned long start;
+    /** Number of entries */
+    unsigned long count;
+    /** Minimum value */
+    float min[VARIABLES];
+    /** Maximum value */
+    float max[VARIABLES];
+    /** Sum of values */
+    double sum[VARIABLES];
+    /** Latest value */
+    float last[VARIABLES];
+
+    /**
+     * @brief      Gets the mean value.
+     *
+     * @param[in]  var   The variable
+     *
+     * @return     The mean.
+     */
+    float mean(Variable var) const { return sum[var] / count; }
+};
+
+/**
+ * @brief      Class for a node's multi-resolution rollups.
+ *
+ * Entries must be inserted in non-decreasing timestamp order.
+ */
+class Rollup
+{
+
+public:
+
+    /** Number of tiers */
+    static const size_t TIERS = 3;
+
+private:
+
+    /** Bucket width of each tier (ms), from finest to coarsest */
+    static const unsigned long WIDTHS[TIERS];
+
+    /** Buckets of each tier */
+    SegmentedBuffer< Bucket > tiers_[TIERS];
+
+public:
+
+    /**
+     * @brief      Constructs empty rollups.
+     */
+    Rollup();
+
+    /**
+     * @brief      Removes every bucket.
+     */
+    void clear();
+
+    /**
+     * @brief      Accumulates an entry into every tier.
+     *
+     * @param[in]  timestamp   The timestamp (ms)
+     * @param[in]  lux         The lux
+     * @param[in]  duty_cycle  The duty cycle
+     */
+    void push_back(unsigned long timestamp, float lux, float duty_cycle);
+
+    /**
+     * @brief      Gets the bucket width of a tier.
+     *
+     * @param[in]  tier  The tier
+     *
+     * @return     The width (ms).
+     */
+    static unsigned long width(size_t tier) { return WIDTHS[tier]; }
+
+    /**
+     * @brief      Selects the coarsest tier not coarser than a resolution.
+     *
+     * @param[in]  resolution  The requested resolution (ms)
+     *
+     * @return     The tier, or TIERS if raw entries are required.
+     */
+    static size_t select(unsigned long resolution);
+
+    /**
+     * @brief      Visits the buckets of a tier overlapping a time period.
+     *
+     * @param[in]  tier   The tier
+     * @param[in]  start  The period start (ms)
+     * @param[in]  end    The period end (ms)
+     * @param[in]  f      The visitor, called as f(const Bucket & bucket)
+     *
+     * @tparam     F      The visitor type
+     */
+    template < typename F >
+    void forEachBucket(size_t tier, unsigned long start, unsigned long end,
+        F f) const
+    {
+        const SegmentedBuffer< Bucket > & buckets = tiers_[tier];
+        for (size_t i = lowerBound(tier, start);
+            i < buckets.size() && buckets[i].start <= end; i++)
+        {
+            f(buckets[i]);
+        }
+    }
+
+private:
+
+    /**
+     * @brief      Finds the first bucket of a tier ending after t.
+     *
+     * @param[in]  tier  The tier
+     * @param[in]  t     The timestamp (ms)
+     *
+     * @return     The bucket index, or the tier size if none.
+     */
+    size_t lowerBound(size_t tier, unsigned long t) const;
+};
+
+#endif
@@ -0,0 +1,313 @@
+/**
+ * @file    rpi/src/SegmentedBuffer.hpp
+ *
+ * @brief   Bounded buffer of fixed-size segments
+ *
+ * Elements are stored in fixed-size segments which are allocated on demand
+ * and recycled through a small pool. Insertion never moves existing
+ * elements, so it runs in constant time and references to stored elements
+ * remain valid until they are removed. Removing the oldest elements
+ * releases memory one whole segment at a time.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#ifndef SEGMENTED_BUFFER_HPP
+#define SEGMENTED_BUFFER_HPP
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+/**
+ * @brief      Class for a bounded segmented buffer.
+ *
+ * Elements are indexed from the oldest (0) to the newest (size() - 1).
+ * When full, pushing a new element discards the oldest one.
+ *
+ * @tparam     T        The element type
+ * @tparam     SEGMENT  The number of elements per segment, a power of two
+ */
+template < typename T, size_t SEGMENT = 1024 >
+class SegmentedBuffer
+{
+
+    static_assert((SEGMENT & (SEGMENT - 1)) == 0,
+        "Segment size must be a power of two");
+
+private:
+
+    /** Segment handle */
+    typedef std::unique_ptr< T[] > Segment;
+
+    /** Number of released segments kept for reuse */
+    static const size_t SPARE_SEGMENTS = 1;
+
+    /** Circular table of live segments */
+    std::vector< Segment > segments_;
+    /** Released segments, awaiting reuse */
+    std::vector< Segment > pool_;
+    /** Table slot of the oldest segment */
+    size_t first_;
+    /** Number of live segments */
+    size_t live_;
+    /** Position of the oldest element within the oldest segment */
+    size_t offset_;
+    /** Number of stored elements */
+    size_t size_;
+    /** Maximum number of elements */
+    size_t capacity_;
+
+public:
+
+    /**
+     * @brief      Constructs a segmented buffer.
+     *
+     * No segment is allocated until the first element is inserted.
+     *
+     * @param[in]  capacity  The maximum number of elements
+     */
+    explicit SegmentedBuffer(size_t capacity = 0)
+        : segments_((capacity)? capacity / SEGMENT + 2 : 0),
+          first_(0), live_(0), offset_(0), size_(0), capacity_(capacity) {}
+
+    /**
+     * @brief      Constructs a copy of another buffer.
+     *
+     * @param[in]  other  The other buffer
+     */
+    SegmentedBuffer(const SegmentedBuffer & other)
+        : SegmentedBuffer(other.capacity_)
+    {
+        other.forEachSpan(0, other.size_,
+            [this](const T *data, size_t n){
+                for (size_t i = 0; i < n; i++) push_back(data[i]);
+            });
+    }
+
+    /**
+     * @brief      Constructs a buffer from a temporary one.
+     *
+     * @param[in]  other  The other buffer
+     */
+    SegmentedBuffer(SegmentedBuffer && other) = default;
+
+    /**
+     * @brief      Assigns a copy of another buffer.
+     *
+     * @param[in]  other  The other buffer
+     *
+     * @return     This buffer.
+     */
+    SegmentedBuffer & operator=(SegmentedBuffer other)
+    {
+        segments_.swap(other.segments_);
+        pool_.swap(other.pool_);
+        std::swap(first_, other.first_);
+        std::swap(live_, other.live_);
+        std::swap(offset_, other.offset_);
+        std::swap(size_, other.size_);
+        std::swap(capacity_, other.capacity_);
+        return *this;
+    }
+
+    /**
+     * @brief      Gets the maximum number of elements.
+     *
+     * @return     The capacity.
+     */
+    size_t capacity() const { return capacity_; }
+
+    /**
+     * @brief      Gets the number of stored elements.
+     *
+     * @return     The size.
+     */
+    size_t size() const { return size_; }
+
+    /**
+     * @brief      Checks whether the buffer is empty.
+     *
+     * @return     True if empty, false otherwise.
+     */
+    bool empty() const { return size_ == 0; }
+
+    /**
+     * @brief      Checks whether the buffer is full.
+     *
+     * @return     True if full, false otherwise.
+     */
+    bool full() const { return size_ == capacity_; }
+
+    /**
+     * @brief      Gets the number of segments currently allocated.
+     *
+     * @return     The number of live and pooled segments.
+     */
+    size_t segments() const { return live_ + pool_.size(); }
+
+    /**
+     * @brief      Removes every element, releasing their segments.
+     */
+    void clear()
+    {
+        while (live_) releaseFirst();
+        offset_ = 0;
+        size_ = 0;
+    }
+
+    /**
+     * @brief      Appends an element, discarding the oldest one if full.
+     *
+     * @param[in]  value  The value
+     */
+    void push_back(const T & value)
+    {
+        if (capacity_ == 0) return;
+        if (full()) pop_front();
+        size_t end = offset_ + size_;
+        if (end == live_ * SEGMENT)
+        {
+            acquireLast();
+        }
+        segments_[slot(end / SEGMENT)][end & (SEGMENT - 1)] = value;
+        size_++;
+    }
+
+    /**
+     * @brief      Removes the oldest element.
+     *
+     * Its segment is released once every element in it has been removed.
+     */
+    void pop_front()
+    {
+        if (empty()) return;
+        offset_++;
+        size_--;
+        if (size_ == 0)
+        {
+            clear();
+        }
+        else if (offset_ == SEGMENT)
+        {
+            releaseFirst();
+            offset_ = 0;
+        }
+    }
+
+    /**
+     * @brief      Accesses an element by logical index.
+     *
+     * @param[in]  i     The index, 0 being the oldest element
+     *
+     * @return     The element.
+     */
+    T & operator[](size_t i)
+    {
+        size_t p = offset_ + i;
+        return segments_[slot(p / SEGMENT)][p & (SEGMENT - 1)];
+    }
+
+    /** @copydoc operator[](size_t) */
+    const T & operator[](size_t i) const
+    {
+        size_t p = offset_ + i;
+        return segments_[slot(p / SEGMENT)][p & (SEGMENT - 1)];
+    }
+
+    /**
+     * @brief      Accesses the contiguous memory span starting at an element.
+     *
+     * @param[in]  i     The logical index
+     * @param      n     The maximum span length, reduced to the span length
+     *
+     * @return     The element address.
+     */
+    const T *span(size_t i, size_t & n) const
+    {
+        size_t p = offset_ + i;
+        size_t pos = p & (SEGMENT - 1);
+        n = std::min(n, SEGMENT - pos);
+        return &segments_[slot(p / SEGMENT)][pos];
+    }
+
+    /**
+     * @brief      Visits a logical range as contiguous memory spans.
+     *
+     * The range is split at segment boundaries.
+     *
+     * @param[in]  first  The first logical index
+     * @param[in]  last   The logical index past the last element
+     * @param[in]  f      The visitor, called as f(const T * data, size_t n)
+     *
+     * @tparam     F      The visitor type
+     */
+    template < typename F >
+    void forEachSpan(size_t first, size_t last, F f) const
+    {
+        if (last > size_) last = size_;
+        size_t p = offset_ + first;
+        size_t end = offset_ + last;
+        while (p < end)
+        {
+            size_t pos = p & (SEGMENT - 1);
+            size_t n = std::min(end - p, SEGMENT - pos);
+            f(&segments_[slot(p / SEGMENT)][pos], n);
+            p += n;
+        }
+    }
+
+private:
+
+    /**
+     * @brief      Maps a segment index to its table slot.
+     *
+     * @param[in]  segment  The segment index, 0 being the oldest
+     *
+     * @return     The table slot.
+     */
+    size_t slot(size_t segment) const
+    {
+        size_t s = first_ + segment;
+        return (s >= segments_.size())? s - segments_.size() : s;
+    }
+
+    /**
+     * @brief      Appends a segment, reusing a pooled one if available.
+     */
+    void acquireLast()
+    {
+        Segment & segment = segments_[slot(live_)];
+        if (pool_.empty())
+        {
+            segment.reset(new T[SEGMENT]);
+        }
+        else
+        {
+            segment = std::move(pool_.back());
+            pool_.pop_back();
+        }
+        live_++;
+    }
+
+    /**
+     * @brief      Releases the oldest segment, to the pool or the allocator.
+     */
+    void releaseFirst()
+    {
+        Segment & segment = segments_[first_];
+        if (pool_.size() < SPARE_SEGMENTS)
+        {
+            pool_.push_back(std::move(segment));
+        }
+        else
+        {
+            segment.reset();
+        }
+        first_ = slot(1);
+        live_--;
+    }
+};
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * @file    rpi/src/Seqlock.hpp
+ *
+ * @brief   Sequence lock for single-writer published values
+ *
+ * Readers never block nor write shared memory: they copy the value and retry
+ * if a concurrent write was detected through the sequence counter.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#ifndef SEQLOCK_HPP
+#define SEQLOCK_HPP
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * @brief      Class for a sequence-locked value.
+ *
+ * Writes must be serialised by the caller (one writer at a time).
+ *
+ * @tparam     T     The value type, which must be trivially copyable
+ */
+template < typename T >
+class Seqlock
+{
+
+private:
+
+    static_assert(std::is_trivially_copyable< T >::value,
+        "Seqlock requires a trivially copyable type");
+
+    /** Sequence counter, odd while a write is in progress */
+    std::atomic< unsigned > seq_;
+    /** Published value */
+    T value_;
+
+public:
+
+    /**
+     * @brief      Constructs a sequence lock with a default value.
+     */
+    Seqlock() : seq_(0), value_() {}
+
+    /**
+     * @brief      Publishes a new value.
+     *
+     * @param[in]  value  The value
+     */
+    void store(const T & value)
+    {
+        unsigned seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(&value_, &value, sizeof(T));
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    /**
+     * @brief      Obtains a consistent copy of the value.
+     *
+     * @return     The value.
+     */
+    T load() const
+    {
+        T value;
+        unsigned before, after;
+        do
+        {
+            before = seq_.load(std::memory_order_acquire);
+            std::memcpy(&value, &value_, sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = seq_.load(std::memory_order_relaxed);
+        }
+        while ((before & 1) || before != after);
+        return value;
+    }
+};
+
+#endif
@@ -0,0 +1,102 @@
+/**
+ * @file    rpi/src/SpscQueue.hpp
+ *
+ * @brief   Lock-free single-producer single-consumer queue
+ *
+ * Bounded ring of preallocated slots, synchronised solely through acquire
+ * and release operations on the head and tail indices.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <vector>
+
+/**
+ * @brief      Class for a bounded lock-free SPSC queue.
+ *
+ * push() may only be called from one thread and pop() from another.
+ *
+ * @tparam     T     The element type
+ */
+template < typename T >
+class SpscQueue
+{
+
+private:
+
+    /** Cache line size, used to keep indices apart */
+    static const size_t CACHE_LINE = 64;
+
+    /** Slot storage, with a power of two size */
+    std::vector< T > slots_;
+    /** Index mask */
+    size_t mask_;
+
+    /** Next slot to be read, owned by the consumer */
+    std::atomic< size_t > head_;
+    /** Padding, so that producer and consumer do not share a cache line */
+    char padding_[CACHE_LINE];
+    /** Next slot to be written, owned by the producer */
+    std::atomic< size_t > tail_;
+
+public:
+
+    /**
+     * @brief      Constructs a queue.
+     *
+     * @param[in]  capacity  The capacity, rounded up to a power of two
+     */
+    explicit SpscQueue(size_t capacity)
+        : head_(0), tail_(0)
+    {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        slots_.resize(size);
+        mask_ = size - 1;
+    }
+
+    /**
+     * @brief      Enqueues an element (producer only).
+     *
+     * @param[in]  value  The value
+     *
+     * @return     False if the queue was full and the value was dropped.
+     */
+    bool push(const T & value)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == slots_.size())
+        {
+            return false;
+        }
+        slots_[tail & mask_] = value;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief      Dequeues an element (consumer only).
+     *
+     * @param      value  The output value
+     *
+     * @return     False if the queue was empty.
+     */
+    bool pop(T & value)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        value = slots_[head & mask_];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+#endif
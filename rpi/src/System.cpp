@@ -55,22 +55,35 @@ void System::start(const std::string & serial, const std::string & i2c)
 
 void System::reset()
 {
-    // Start tracking execution time
-    start_ = 0;
-    start_ = System::millis();
-    // Clear variables, but ensure size is kept
-    boost::unique_lock<boost::shared_mutex> lock(mutex_);
-    for (int i = 0; i < nodes_; i++)
+    boost::mutex::scoped_lock reset_lock(reset_mutex_);
+
+    // Start tracking execution time, as millis() counts from start_
+    start_ += System::millis();
     {
-        entries_.at(i).clear();
-        entries_.resize(nodes_);
+        boost::mutex::scoped_lock sync_lock(sync_mutex_);
+        boost::mutex::scoped_lock lock(journal_mutex_);
+        if (journal_.isOpen())
+        {
+            // Each session gets its own file, so the journal only grows
+            // with the session replayed on restart
+            journal_.rotate();
+            session_start_ = journal_.size();
+            journal_.appendReset(start_);
+        }
+    }
+    // Clear variables, but ensure size is kept
+    for (size_t id = 0; id < nodes_; id++)
+    {
+        NodeStore & shard = shards_[id];
+        boost::unique_lock<boost::shared_mutex> lock(shard.mutex);
+        shard.entries.clear();
+        shard.archive.clear();
+        shard.rollup.clear();
+        shard.tracking_error.clear();
+        shard.duty_cycle.clear();
+        // Publish a cleared state, withdrawing the node's share of totals
+        state_[id].store(NodeState());
     }
-    lux_lower_bound_.clear();
-    lux_external_.clear();
-    occupancy_.clear();
-    lux_lower_bound_.resize(nodes_);
-    lux_external_.resize(nodes_);
-    occupancy_.resize(nodes_);
 }
 
 void System::startRead()
@@ -128,20 +141,20 @@ void System::handleRead(const boost::system::error_code & error,
                     " occ " << (bool) occupancy <<
                     " t "   << timestamp);
 
-                // Update values in memory
-                try
+                // Hand over to the commit stage
+                Sample sample;
+                sample.id = id;
+                sample.timestamp = timestamp;
+                sample.lux = lux;
+                sample.duty_cycle = dc;
+                sample.lux_reference = ref;
+                sample.lux_lower_bound = lb;
+                sample.lux_external = ext;
+                sample.occupancy = occupancy;
+                if (!ingest_queue_.push(sample))
                 {
-                    lux_lower_bound_.at(id) = lb;
-                    lux_external_.at(id)    = ext;
-                    occupancy_.at(id)       = occupancy;
+                    errPrintTrace("Ingest queue full, dropped sample from node " << (int) id);
                 }
-                catch( std::out_of_range & e)
-                {
-                    errPrintTrace(e.what());
-                }
-                float c_err = getComfortError(id, false);
-                float c_var = getComfortVariance(id, false);
-                insertEntry((size_t) id, timestamp, lux, dc, ref, c_err, c_var);
             }
         }
         startRead();
@@ -160,17 +173,184 @@ void System::runSerial(){
     io_serial_.run();
 }
 
+bool System::openJournal(const std::string & path, bool restore)
+{
+    // Replay before opening for writing, so restored samples are not
+    // journaled again
+    bool restored = false;
+    size_t session_start = 0;
+    if (restore)
+    {
+        JournalReader reader;
+        if (reader.open(path))
+        {
+            session_start = ExportJob::sessionStart(reader, reader.size());
+            restored = System::restore(reader);
+        }
+    }
+
+    boost::mutex::scoped_lock sync_lock(sync_mutex_);
+    boost::mutex::scoped_lock lock(journal_mutex_);
+    if (!journal_.open(path, nodes_, sample_period_)) return false;
+    journal_path_ = path;
+    debugPrintTrace("Opened journal " << path << " with "
+        << journal_.size() << " records.");
+    if (restored)
+    {
+        session_start_ = session_start;
+    }
+    else
+    {
+        if (journal_.size() > 0 && !journal_.rotate()) return false;
+        session_start_ = journal_.size();
+        journal_.appendReset(start_);
+    }
+    return true;
+}
+
+bool System::restore(const JournalReader & journal)
+{
+    auto begin = std::chrono::steady_clock::now();
+
+    size_t first = ExportJob::sessionStart(journal, journal.size()) + 1;
+    if (first > journal.size() ||
+        !(journal[first - 1].flags & JournalRecord::FLAG_RESET))
+    {
+        return false;
+    }
+
+    reset();
+    start_ = journal[first - 1].timestamp;
+
+    // Nodes are independent, so each thread replays a subset of them,
+    // scanning the journal in order through its own window
+    size_t threads = std::max< size_t >(1,
+        std::min< size_t >(nodes_, std::thread::hardware_concurrency()));
+    std::vector< size_t > counts(threads, 0);
+    auto replay = [&](size_t k){
+        JournalReader view;
+        if (!view.open(journal)) return;
+        // Batch per node, so each node lock is taken once per batch
+        std::vector< std::vector< Sample > > batches(nodes_);
+        for (size_t i = first; i < view.size(); i++)
+        {
+            const JournalRecord & r = view[i];
+            if (!(r.flags & JournalRecord::FLAG_VALID) ||
+                r.id >= nodes_ || r.id % threads != k) continue;
+            std::vector< Sample > & batch = batches[r.id];
+            batch.emplace_back();
+            Sample & sample = batch.back();
+            sample.id = r.id;
+            sample.timestamp = r.timestamp;
+            sample.lux = r.lux;
+            sample.duty_cycle = r.duty_cycle;
+            sample.lux_reference = r.lux_reference;
+            sample.lux_lower_bound = r.lux_lower_bound;
+            sample.lux_external = r.lux_external;
+            sample.occupancy = r.occupancy;
+            if (batch.size() == COMMIT_BATCH)
+            {
+                insertEntries(batch.data(), batch.size());
+                counts[k] += batch.size();
+                batch.clear();
+            }
+        }
+        for (auto & batch : batches)
+        {
+            insertEntries(batch.data(), batch.size());
+            counts[k] += batch.size();
+        }
+    };
+    std::vector< std::thread > workers;
+    for (size_t k = 1; k < threads; k++)
+    {
+        workers.emplace_back(replay, k);
+    }
+    replay(0);
+    for (auto & worker : workers) worker.join();
+    size_t restored = 0;
+    for (size_t count : counts) restored += count;
+
+    debugPrintTrace("Restored " << restored << " entries in "
+        << std::chrono::duration< double >(
+            std::chrono::steady_clock::now() - begin).count() << " s.");
+    return true;
+}
+
+void System::runJournal()
+{
+    while (true)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(JOURNAL_SYNC_PERIOD));
+        boost::mutex::scoped_lock lock(sync_mutex_);
+        journal_.sync();
+    }
+}
+
+void System::runExport()
+{
+    while (true)
+    {
+        ExportJob::ptr job;
+        {
+            boost::mutex::scoped_lock lock(export_mutex_);
+            while (export_queue_.empty()) export_ready_.wait(lock);
+            job = export_queue_.front();
+            export_queue_.pop_front();
+        }
+        {
+            boost::mutex::scoped_lock lock(sync_mutex_);
+            journal_.sync();
+        }
+        job->run();
+        debugPrintTrace("Exported " << job->exported() << " entries to "
+            << job->directory());
+    }
+}
+
+void System::runCommit()
+{
+    Sample batch[COMMIT_BATCH];
+    while (true)
+    {
+        size_t count = 0;
+        while (count < COMMIT_BATCH && ingest_queue_.pop(batch[count]))
+        {
+            count++;
+        }
+        if (count)
+        {
+            insertEntries(batch, count);
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(COMMIT_PERIOD));
+        }
+    }
+}
+
 void System::startWriteSerial(const std::string & msg)
 {
-    boost::system::error_code error;
     std::string crnl("\r\n");
-    std::string serial(msg);
-    std::string send = serial + crnl;
+    std::string send = msg + crnl;
     debugPrintTrace("[Serial] Message ready to be sent: " << send);
-    boost::asio::async_write(serial_port_, boost::asio::buffer(send.c_str(), send.size()),
-        boost::bind(& System::handleWriteSerial, this,
+    // Sessions run on several threads, so the queue is only touched on the
+    // Serial strand, and each message is written once the previous one is
+    serial_strand_.post([this, send](){
+        serial_queue_.push_back(send);
+        if (serial_queue_.size() == 1) writeSerial();
+    });
+}
+
+void System::writeSerial()
+{
+    // Queued messages keep their place until written, as deque elements do
+    // not move on insertion at the back
+    const std::string & send = serial_queue_.front();
+    boost::asio::async_write(serial_port_, boost::asio::buffer(send),
+        serial_strand_.wrap(boost::bind(& System::handleWriteSerial, this,
             boost::asio::placeholders::error,
-            boost::asio::placeholders::bytes_transferred));
+            boost::asio::placeholders::bytes_transferred)));
 }
 
 void System::handleWriteSerial(const boost::system::error_code & error,
@@ -179,6 +359,8 @@ void System::handleWriteSerial(const boost::system::error_code & error,
     if (!error)
     {
         debugPrintTrace("[Serial] Message sent.");
+        serial_queue_.pop_front();
+        if (!serial_queue_.empty()) writeSerial();
     }
     else
     {
@@ -195,60 +377,181 @@ void System::insertEntry(
     float lux,
     float duty_cycle,
     float lux_reference,
-    float c_err,
-    float c_var)
+    float lux_lower_bound,
+    float lux_external,
+    bool occupancy)
+{
+    Sample sample;
+    sample.id = id;
+    sample.timestamp = timestamp;
+    sample.lux = lux;
+    sample.duty_cycle = duty_cycle;
+    sample.lux_reference = lux_reference;
+    sample.lux_lower_bound = lux_lower_bound;
+    sample.lux_external = lux_external;
+    sample.occupancy = occupancy;
+
+    insertEntries(&sample, 1);
+}
+
+void System::insertEntries(const Sample *samples, size_t count)
 {
-    boost::unique_lock<boost::shared_mutex> lock(mutex_);
-    try
     {
-        entries_.at(id).emplace_back(timestamp, lux, duty_cycle, lux_reference, c_err, c_var);
+        boost::mutex::scoped_lock lock(journal_mutex_);
+        if (journal_.isOpen())
+        {
+            for (size_t j = 0; j < count; j++)
+            {
+                const Sample & sample = samples[j];
+                JournalRecord record;
+                record.timestamp = sample.timestamp;
+                record.id = sample.id;
+                record.occupancy = sample.occupancy;
+                record.flags = 0;
+                record.lux = sample.lux;
+                record.duty_cycle = sample.duty_cycle;
+                record.lux_reference = sample.lux_reference;
+                record.lux_lower_bound = sample.lux_lower_bound;
+                record.lux_external = sample.lux_external;
+                journal_.append(record);
+            }
+        }
     }
-    catch (const std::out_of_range & e)
+
+    size_t i = 0;
+    while (i < count)
     {
-        errPrintTrace(e.what());
+        // Consecutive samples from the same node share one lock acquisition
+        size_t last = i + 1;
+        while (last < count && samples[last].id == samples[i].id) last++;
+        try
+        {
+            NodeStore & shard = shards_.at(samples[i].id);
+            boost::unique_lock<boost::shared_mutex> lock(shard.mutex);
+            for (; i < last; i++)
+            {
+                insertLocked(shard, samples[i]);
+            }
+        }
+        catch (const std::out_of_range & e)
+        {
+            errPrintTrace(e.what());
+            i = last;
+        }
     }
 }
 
-void System::saveEntries(){
+void System::insertLocked(NodeStore & shard, const Sample & sample)
+{
+    History & entries = shard.entries;
+    const Metrics & metrics = entries.metrics();
+
+    // Update running metrics
+    Entry entry(sample.timestamp, sample.lux, sample.duty_cycle,
+        sample.lux_reference, 0, 0, sample.occupancy);
+    if (entries.full())
+    {
+        // Compress the entry about to be displaced into the cold log
+        shard.archive.push_back(entries.entry(0), entries.metricsBefore(0));
+    }
+    entries.push_back(entry);
+    entry.c_err = metrics.comfortError();
+    entry.c_var = metrics.comfortVariance(sample_period_);
+
+    shard.rollup.push_back(sample.timestamp, sample.lux, sample.duty_cycle);
+    shard.tracking_error.add(sample.lux_reference - sample.lux);
+    shard.duty_cycle.add(sample.duty_cycle);
+
+    // Apply age-based retention; capacity is enforced by the history
+    while (retention_ && !entries.empty() &&
+        entries.timestamp(0) + retention_ < sample.timestamp)
+    {
+        entries.pop_front();
+    }
+    if (retention_ && sample.timestamp > retention_)
+    {
+        shard.archive.expire(sample.timestamp - retention_);
+    }
+
+    // Publish the latest state and the node's share of the totals for
+    // lock-free readers
+    NodeState state;
+    state.valid = true;
+    state.entry = entry;
+    state.lux_lower_bound = sample.lux_lower_bound;
+    state.lux_external = sample.lux_external;
+    state.occupancy = sample.occupancy;
+    state.share.reporting = 1;
+    state.share.power = sample.duty_cycle;
+    state.share.energy = metrics.energy();
+    state.share.comfort_error = metrics.comfortError();
+    state.share.comfort_variance = metrics.comfortVariance(sample_period_);
+    state_[sample.id].store(state);
+}
 
-    for (int id = 0; id < nodes_; id++)
+Totals System::loadTotals() const
+{
+    Totals totals = Totals();
+    for (const Seqlock< NodeState > & node : state_)
+    {
+        totals.add(node.load().share);
+    }
+    return totals;
+}
+
+ExportJob::ptr System::saveEntries(
+    ExportJob::Format format,
+    const std::string & directory)
+{
+    ExportJob::ptr job;
     {
-        std::string filename(std::to_string(id) + ".csv");
-        std::ofstream output(filename.c_str());
-        if (!output.is_open())
+        // Records up to the current size are final, so they form a snapshot
+        boost::mutex::scoped_lock lock(journal_mutex_);
+        if (!journal_.isOpen())
         {
-            return;
+            errPrintTrace("No journal to save entries from");
+            return job;
         }
-
-        boost::shared_lock<boost::shared_mutex> lock(mutex_);
-        for (auto & e : entries_.at(id))
+        job.reset(new ExportJob(journal_path_, directory, session_start_,
+            journal_.size(), format));
+        // Opened now, as the journal is replaced on the next reset
+        if (!job->open())
         {
-            output <<
-            e.timestamp     << "," <<
-            e.lux           << "," <<
-            e.duty_cycle    << "," <<
-            e.lux_reference << "," <<
-            e.c_err         << "," <<
-            e.c_var         << "\n";
-
+            errPrintTrace("Could not read journal " << journal_path_);
+            return ExportJob::ptr();
         }
-        output.close();
     }
-
+    {
+        boost::mutex::scoped_lock lock(export_mutex_);
+        export_queue_.push_back(job);
+    }
+    export_ready_.notify_one();
+    return job;
 }
 
-Entry *System::getLatestEntry(size_t id)
+bool System::getLatestEntry(size_t id, Entry & entry)
 {
-    boost::shared_lock<boost::shared_mutex> lock(mutex_);
     try
     {
-        return (entries_.at(id).empty())?
-            nullptr : &entries_.at(id).back();
+        NodeState state = state_.at(id).load();
+        entry = state.entry;
+        return state.valid;
     }
     catch (const std::out_of_range & e)
     {
         errPrintTrace(e.what());
-        return nullptr;
+        return false;
+    }
+}
+
+void System::getSnapshot(std::vector< NodeState > & states, Totals & totals)
+{
+    states.resize(nodes_);
+    totals = Totals();
+    for (size_t id = 0; id < nodes_; id++)
+    {
+        states[id] = state_[id].load();
+        totals.add(states[id].share);
     }
 }
 
@@ -257,30 +560,44 @@ void System::getValuesInPeriod(
     unsigned long start,
     unsigned long end,
     char var,
-    std::string & response)
+    std::string & response,
+    unsigned long resolution)
 {
     response = "";
-    std::string value_str = "";
-    float value = -1;
+    // TODO - Use macro
+    History::Column col = (var == 'l')?
+        History::COL_LUX : History::COL_DUTY_CYCLE;
+    Bucket::Variable bucket_var = (var == 'l')?
+        Bucket::VAR_LUX : Bucket::VAR_DUTY_CYCLE;
+    size_t tier = Rollup::select(resolution);
 
-    boost::shared_lock<boost::shared_mutex> lock(mutex_);
     try
     {
-        for (auto & e : entries_.at(id))
+        NodeStore & shard = shards_.at(id);
+        boost::shared_lock<boost::shared_mutex> lock(shard.mutex);
+        std::stringstream stream;
+        stream << std::fixed << std::setprecision(2);
+        if (tier < Rollup::TIERS)
         {
-            if (e.timestamp >= start && e.timestamp <= end)
-            {
-                // TODO - Use macro
-                if (var == 'l') value = e.lux;
-                else            value = e.duty_cycle;
-                
-                std::stringstream stream;
-                stream << std::fixed << std::setprecision(2) << value;
-                value_str = stream.str();
-
-                response += (value_str + ", ");
-            }
+            shard.rollup.forEachBucket(tier, start, end,
+                [&](const Bucket & bucket){
+                    stream << bucket.mean(bucket_var) << ", ";
+                });
+        }
+        else
+        {
+            // Older entries are decoded from the cold log
+            shard.archive.forEachEntry(start, end,
+                [&](const Entry & e){
+                    stream << ((var == 'l')? e.lux : e.duty_cycle) << ", ";
+                });
+            History & entries = shard.entries;
+            size_t first = entries.lowerBound(start);
+            size_t last = entries.upperBound(end);
+            entries.forEachValue(col, first, last,
+                [&](float value){ stream << value << ", "; });
         }
+        response = stream.str();
         if (!response.empty()) response.erase(response.size() - 2);
     }
     catch (const std::out_of_range & e)
@@ -292,11 +609,10 @@ void System::getValuesInPeriod(
 
 float System::getLux(size_t id)
 {
-    boost::shared_lock<boost::shared_mutex> lock(mutex_);
     try
     {
-        return (entries_.at(id).empty())?
-            -1 : entries_.at(id).back().lux;
+        NodeState state = state_.at(id).load();
+        return (state.valid)? state.entry.lux : -1;
     }
     catch (const std::out_of_range & e)
     {
@@ -307,11 +623,10 @@ float System::getLux(size_t id)
 
 float System::getDutyCycle(size_t id)
 {
-    boost::shared_lock<boost::shared_mutex> lock(mutex_);
     try
     {
-        return (entries_.at(id).empty())?
-            -1 : entries_.at(id).back().duty_cycle;
+        NodeState state = state_.at(id).load();
+        return (state.valid)? state.entry.duty_cycle : -1;
     }
     catch (const std::out_of_range & e)
     {
@@ -322,10 +637,10 @@ float System::getDutyCycle(size_t id)
 
 bool System::getOccupancy(size_t id)
 {
-    boost::shared_lock<boost::shared_mutex> lock(mutex_);
     try
     {
-        return occupancy_.at(id);
+        NodeState state = state_.at(id).load();
+        return state.occupancy;
     }
     catch (const std::out_of_range & e)
     {
@@ -336,10 +651,10 @@ bool System::getOccupancy(size_t id)
 
 float System::getLuxLowerBound(size_t id)
 {
-    boost::shared_lock<boost::shared_mutex> lock(mutex_);
     try
     {
-        return lux_lower_bound_.at(id);
+        NodeState state = state_.at(id).load();
+        return state.lux_lower_bound;
     }
     catch (const std::out_of_range & e)
     {
@@ -350,10 +665,10 @@ float System::getLuxLowerBound(size_t id)
 
 float System::getLuxExternal(size_t id)
 {
-    boost::shared_lock<boost::shared_mutex> lock(mutex_);
     try
     {
-        return lux_external_.at(id);
+        NodeState state = state_.at(id).load();
+        return state.lux_external;
     }
     catch (const std::out_of_range & e)
     {
@@ -364,11 +679,10 @@ float System::getLuxExternal(size_t id)
 
 float System::getLuxReference(size_t id)
 {
-    boost::shared_lock<boost::shared_mutex> lock(mutex_);
     try
     {
-        return (entries_.at(id).empty())?
-            -1 : entries_.at(id).back().lux_reference;
+        NodeState state = state_.at(id).load();
+        return (state.valid)? state.entry.lux_reference : -1;
     }
     catch (const std::out_of_range & e)
     {
@@ -379,59 +693,42 @@ float System::getLuxReference(size_t id)
 
 float System::getPower(size_t id, bool total)
 {
-    float power_i, power = 0.0;
-
     if (!total)
     {
-        power = getDutyCycle(id); // * 1.0 W
-    }
-    else
-    {
-        for (int i = 0; i < nodes_; i++)
-        {
-            power_i = getDutyCycle(i);
-            power += power_i;
-            if (power_i == -1) return -1;
-        }
+        return getDutyCycle(id); // * 1.0 W
     }
-    return power;
+    // Total is only defined once every node has reported
+    Totals totals = loadTotals();
+    return ((size_t) totals.reporting == nodes_)? totals.power : -1;
 }
 
 float System::energyNode(size_t id)
 {
-    float d_prev, energy = 0.0;
-    unsigned long t_cur, t_prev, t_diff;
-    boost::shared_lock<boost::shared_mutex> lock(mutex_);
-    
-    int length = entries_.at(id).size();
-    for (int i = 1; i < length; i++)
-    {
-        d_prev = entries_.at(id).at(i - 1).duty_cycle;
-        t_prev = entries_.at(id).at(i - 1).timestamp;
-        t_cur  = entries_.at(id).at(i).timestamp;
-        t_diff = t_cur - t_prev; // ms
-        energy += d_prev * (t_diff / 1000.0);
-    }
-    return energy;
+    return state_.at(id).load().share.energy;
 }
 
-float System::getEnergy(size_t id, bool total)
+float System::getEnergy(size_t id, bool total, unsigned long window)
 {
-    float energy = 0.0;
     try
     {
-        if (!total)
-        {
-            energy = energyNode(id);
-        }
-        else
+        if (window)
         {
-            for (int i = 0; i < nodes_; i++)
+            if (!total)
+            {
+                return windowNode(id, window).energy();
+            }
+            double sum = 0.0;
+            for (size_t i = 0; i < nodes_; i++)
             {
-                energy += energyNode(i);
+                sum += windowNode(i, window).energy();
             }
+            return sum;
         }
-        return energy;
+        if (!total)
+        {
+            return energyNode(id);
+        }
+        return loadTotals().energy;
     }
     catch (const std::out_of_range & e)
     {
@@ -442,37 +739,66 @@ float System::getEnergy(size_t id, bool total)
 
 float System::comfortErrorNode(size_t id)
 {
-    float lux_ref, lux, comfort_error = 0.0;
-    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+    return state_.at(id).load().entry.c_err;
+}
 
-    int length = entries_.at(id).size();
-    for (int i = 0; i < length; i++)
+float System::getComfortError(size_t id, bool total, unsigned long window)
+{
+    try
+    {
+        if (window)
+        {
+            if (!total)
+            {
+                return windowNode(id, window).comfortError();
+            }
+            double sum = 0.0;
+            for (size_t i = 0; i < nodes_; i++)
+            {
+                sum += windowNode(i, window).comfortError();
+            }
+            return sum;
+        }
+        if (!total)
+        {
+            return comfortErrorNode(id);
+        }
+        return loadTotals().comfort_error;
+    }
+    catch (const std::out_of_range & e)
     {
-        lux_ref = entries_.at(id).at(i).lux_reference;
-        lux = entries_.at(id).at(i).lux;
-        comfort_error += std::max(lux_ref - lux, 0.0f);
+        errPrintTrace(e.what());
+        return -1;
     }
-    return comfort_error / length;
 }
 
-float System::getComfortError(size_t id, bool total)
+float System::comfortVarianceNode(size_t id)
 {
-    float comfort_error = 0.0;
+    return state_.at(id).load().entry.c_var;
+}
 
+float System::getComfortVariance(size_t id, bool total, unsigned long window)
+{
     try
     {
-        if (!total)
+        if (window)
         {
-            comfort_error = comfortErrorNode(id);
-        }
-        else
-        {
-            for (int i = 0; i < nodes_; i++)
+            if (!total)
+            {
+                return windowNode(id, window).comfortVariance(sample_period_);
+            }
+            double sum = 0.0;
+            for (size_t i = 0; i < nodes_; i++)
             {
-                comfort_error += comfortErrorNode(i);
+                sum += windowNode(i, window).comfortVariance(sample_period_);
             }
+            return sum;
         }
-        return comfort_error;
+        if (!total)
+        {
+            return comfortVarianceNode(id);
+        }
+        return loadTotals().comfort_variance;
     }
     catch (const std::out_of_range & e)
     {
@@ -481,56 +807,78 @@ float System::getComfortError(size_t id, bool total)
     }
 }
 
-float System::comfortVarianceNode(size_t id)
+bool System::getQuantiles(
+    size_t id,
+    bool total,
+    char var,
+    const std::vector< double > & quantiles,
+    std::vector< double > & values)
 {
-    float lux, lux_1, lux_2, comfort_variance = 0.0;
-    boost::shared_lock<boost::shared_mutex> lock(mutex_);
-
-    int length = entries_.at(id).size();
-    for (int i = 2; i < length; i++)
+    // Sketches are copied under each node's lock, then queried unlocked
+    TDigest digest(TDIGEST_COMPRESSION);
+    size_t first = (total)? 0 : id;
+    size_t last = (total)? nodes_ : id + 1;
+    try
+    {
+        for (size_t i = first; i < last; i++)
+        {
+            NodeStore & shard = shards_.at(i);
+            boost::shared_lock<boost::shared_mutex> lock(shard.mutex);
+            digest.merge((var == 'd')? shard.duty_cycle : shard.tracking_error);
+        }
+    }
+    catch (const std::out_of_range & e)
     {
-        lux = entries_.at(id).at(i).lux;
-        lux_1 = entries_.at(id).at(i-1).lux;
-        lux_2 = entries_.at(id).at(i-2).lux;
+        errPrintTrace(e.what());
+        return false;
+    }
 
-        comfort_variance += (std::abs(lux - 2*lux_1 + lux_2));
+    // Without samples, quantiles read -1, as other getters do
+    values.clear();
+    for (double q : quantiles)
+    {
+        values.push_back((digest.count() > 0)? digest.quantile(q) : -1);
     }
-    return comfort_variance / (length * std::pow(sample_period_, 2));
+    return true;
 }
 
-float System::getComfortVariance(size_t id, bool total)
+bool System::query(const Query & query, std::vector< QueryBucket > & buckets)
 {
-    float comfort_variance = 0.0;
-
+    buckets.assign(query.buckets(), QueryBucket());
     try
     {
-        if (!total)
+        for (size_t id : query.nodes)
         {
-            comfort_variance = comfortVarianceNode(id);
+            NodeStore & shard = shards_.at(id);
+            boost::shared_lock<boost::shared_mutex> lock(shard.mutex);
+            query.scan(shard.entries, shard.archive, buckets);
         }
-        else
-        {
-            for (int i = 0; i < nodes_; i++)
-            {
-                comfort_variance += comfortVarianceNode(i);
-            }
-        }
-        return comfort_variance;
     }
     catch (const std::out_of_range & e)
     {
         errPrintTrace(e.what());
-        return -1;
+        return false;
     }
+    return true;
+}
+
+Metrics System::windowNode(size_t id, unsigned long window)
+{
+    unsigned long now = millis();
+    unsigned long start = (now > window)? now - window : 0;
+
+    NodeStore & shard = shards_.at(id);
+    boost::shared_lock<boost::shared_mutex> lock(shard.mutex);
+    const History & entries = shard.entries;
+    return entries.metrics().since(entries.metricsBefore(entries.lowerBound(start)));
 }
 
 unsigned long System::getTimestamp(size_t id)
 {
-    boost::shared_lock<boost::shared_mutex> lock(mutex_);
     try
     {
-        return (entries_.at(id).empty())?
-            -1 : entries_.at(id).back().timestamp;
+        NodeState state = state_.at(id).load();
+        return (state.valid)? state.entry.timestamp : -1;
     }
     catch (const std::out_of_range & e)
     {
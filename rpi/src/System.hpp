@@ -20,10 +20,16 @@
 #include <ctime>
 #include <vector>
 #include <list>
+#include <deque>
 #include <algorithm>
 #include <chrono>
+#include <climits>
+#include <thread>
+#include <atomic>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
@@ -31,6 +37,16 @@
 #include "debug.hpp"
 #include "constants.hpp"
 #include "communication.hpp"
+#include "Metrics.hpp"
+#include "History.hpp"
+#include "Rollup.hpp"
+#include "Archive.hpp"
+#include "TDigest.hpp"
+#include "Journal.hpp"
+#include "JournalExport.hpp"
+#include "Query.hpp"
+#include "Seqlock.hpp"
+#include "SpscQueue.hpp"
 
 /** Flag for obtaining lux values */
 #define GET_LUX         0
@@ -38,49 +54,116 @@
 #define GET_DUTY_CYCLE  1
 
 /**
- * @brief      Class for entry.
+ * @brief      Class for system-wide totals, or a node's share of them.
+ *
+ * Each node publishes its share with its state, so that totals are summed
+ * over nodes on read and writers of different nodes never contend.
+ */
+class Totals
+{
+
+public:
+
+    /** Number of nodes with any entry since last reset */
+    long reporting;
+    /** Instantaneous power */
+    double power;
+    /** Accumulated energy */
+    double energy;
+    /** Accumulated comfort error */
+    double comfort_error;
+    /** Accumulated comfort variance */
+    double comfort_variance;
+
+    /**
+     * @brief      Adds a node's share.
+     *
+     * @param[in]  share  The share
+     */
+    void add(const Totals & share)
+    {
+        reporting += share.reporting;
+        power += share.power;
+        energy += share.energy;
+        comfort_error += share.comfort_error;
+        comfort_variance += share.comfort_variance;
+    }
+};
+
+/**
+ * @brief      Class for a node's latest state.
+ *
+ * Published through the node's sequence lock on every insertion, so that
+ * readers obtain a consistent copy without taking the node mutex.
+ */
+class NodeState
+{
+
+public:
+
+    /** Whether any entry was registered since last reset */
+    bool valid;
+    /** Latest entry */
+    Entry entry;
+    /** Illuminance lower bound */
+    float lux_lower_bound;
+    /** External illuminance */
+    float lux_external;
+    /** Occupancy */
+    bool occupancy;
+    /** Share of the totals: reporting, power, accumulated metrics */
+    Totals share;
+};
+
+/**
+ * @brief      Class for a node's logs and metrics, guarded by its own lock.
+ */
+class NodeStore
+{
+
+public:
+
+    /** Mutex for thread-safe access to this node */
+    boost::shared_mutex mutex;
+    /**
+     * Registered log entries, bounded by the retention policy, and running
+     * performance metrics
+     */
+    History entries;
+    /** Compressed log entries displaced from the history */
+    Archive archive;
+    /** Downsampled log, outliving raw entries */
+    Rollup rollup;
+    /** Distribution of the tracking error (reference minus lux) since reset */
+    TDigest tracking_error;
+    /** Distribution of the duty cycle since reset */
+    TDigest duty_cycle;
+};
+
+/**
+ * @brief      Class for a raw sample received from a node.
  */
-class Entry
+class Sample
 {
 
 public:
 
-    /** Entry timestamp */
+    /** Node identifier */
+    size_t id;
+    /** Reception timestamp */
     unsigned long timestamp;
-    /** Registered lux value */
+    /** Measured illuminance */
     float lux;
-    /** Registered duty cycle */
+    /** Duty cycle */
     float duty_cycle;
     /** Reference illuminance */
     float lux_reference;
-    /** Comfort error */
-    float c_err;
-    /** Comfort variance */
-    float c_var;
-
-    /**
-     * @brief      Constructs an entry.
-     *
-     * @param[in]  timestamp_      The timestamp
-     * @param[in]  lux_            The lux
-     * @param[in]  duty_cycle_     The duty cycle
-     * @param[in]  lux_reference_  The lux reference
-     * @param[in]  c_err_          The comfort error
-     * @param[in]  c_var_          The comfort variance
-     */
-    Entry(
-        unsigned long timestamp_,
-        float lux_, 
-        float duty_cycle_,
-        float lux_reference_,
-        float c_err_,
-        float c_var_)
-        : timestamp(timestamp_),
-          lux(lux_),
-          duty_cycle(duty_cycle_),
-          lux_reference(lux_reference_),
-          c_err(c_err_),
-          c_var(c_var_){}
+    /** Illuminance lower bound */
+    float lux_lower_bound;
+    /** External illuminance */
+    float lux_external;
+    /** Occupancy */
+    bool occupancy;
 };
 
 /**
@@ -100,22 +183,43 @@ private:
     size_t nodes_;
     /** Sampling period */
     float sample_period_;
-    /** System initialisation timestamp */
-    unsigned long start_;
+    /** System initialisation timestamp, read by every thread through millis() */
+    std::atomic< unsigned long > start_;
+    /** Mutex serialising resets, which may be requested by any session */
+    boost::mutex reset_mutex_;
+    /** Maximum number of log entries per node */
+    size_t capacity_;
+    /** Maximum age of log entries (ms), 0 for no limit */
+    unsigned long retention_;
     
     /* Direct measurements */
 
-    /** Mutex for thread-safe data access */
-    boost::shared_mutex mutex_;
-    /** Registered log entries */
-    std::vector < std::vector< Entry > > entries_;
-
-    /** Illuminance lower bound for each desk */
-    std::vector< float > lux_lower_bound_;
-    /** External illuminance for each desk */
-    std::vector< float > lux_external_;
-    /** Current occupancy for each desk */
-    std::vector< bool > occupancy_;
+    /** Log and metrics of each node, locked independently */
+    std::vector< NodeStore > shards_;
+
+    /** Latest state of each node, written under its lock, read without */
+    std::vector< Seqlock< NodeState > > state_;
+
+    /** Samples parsed by the I2C thread, awaiting commit */
+    SpscQueue< Sample > ingest_queue_;
+
+    /** Mutex serialising journal appends */
+    boost::mutex journal_mutex_;
+    /** Mutex serialising journal syncs with its rotation, taken first */
+    boost::mutex sync_mutex_;
+    /** Persistent record of every inserted sample */
+    Journal journal_;
+    /** Journal file path */
+    std::string journal_path_;
+    /** Index of the journal record starting the current session */
+    size_t session_start_;
+
+    /** Mutex guarding the export queue */
+    boost::mutex export_mutex_;
+    /** Signalled when an export is queued */
+    boost::condition_variable export_ready_;
+    /** Exports awaiting the export worker */
+    std::deque< ExportJob::ptr > export_queue_;
 
     /* Communication handles */
     
@@ -126,6 +230,12 @@ private:
 
     /* Synchronous Serial connection for outgoing commands */
     boost::asio::serial_port serial_port_;
+    /** Strand serialising Serial writes and the access to their queue */
+    boost::asio::io_service::strand serial_strand_;
+    /** Keeps the Serial service running while no write is pending */
+    boost::asio::io_service::work serial_work_;
+    /** Messages awaiting their write to Serial, the first one being written */
+    std::deque< std::string > serial_queue_;
     /** Asynchronous I2C sniffer for incoming information */
     boost::asio::posix::stream_descriptor i2c_;
     /** I2C pipe file descriptor */
@@ -138,26 +248,62 @@ public:
     /**
      * @brief      Constructs a system.
      *
-     * @param[in]  nodes   The number of nodes in the system
-     * @param[in]  t_s     The period of the system information feed
-     * @param[in]  serial  The Serial port identifier
-     * @param[in]  i2c     The I2C packet stream FIFO path
+     * @param[in]  nodes     The number of nodes in the system
+     * @param[in]  t_s       The period of the system information feed
+     * @param[in]  capacity  The maximum number of log entries per node
+     * @param[in]  retention The maximum age of log entries (s), 0 for no limit
+     * @param[in]  serial    The Serial port identifier
+     * @param[in]  i2c       The I2C packet stream FIFO path
      */
     System(
         size_t nodes,
         float t_s,
+        size_t capacity,
+        unsigned long retention,
         const std::string & serial,
         const std::string & i2c)
+        : System(nodes, t_s, capacity, retention)
+    {
+        start(serial, i2c);
+    }
+
+    /**
+     * @brief      Constructs a system without communication interfaces.
+     *
+     * Entries may only be inserted directly, e.g. for offline processing.
+     *
+     * @param[in]  nodes     The number of nodes in the system
+     * @param[in]  t_s       The period of the system information feed
+     * @param[in]  capacity  The maximum number of log entries per node
+     * @param[in]  retention The maximum age of log entries (s), 0 for no limit
+     */
+    System(
+        size_t nodes,
+        float t_s,
+        size_t capacity,
+        unsigned long retention)
         : nodes_(nodes),
           sample_period_(t_s),
-          entries_(nodes * STREAM_FLAGS, std::vector < Entry >()),
-          lux_lower_bound_(nodes),
-          lux_external_(nodes),
-          occupancy_(nodes),
+          start_(0),
+          capacity_(capacity),
+          retention_(retention * 1000),
+          shards_(nodes),
+          state_(nodes),
+          ingest_queue_(INGEST_QUEUE),
+          session_start_(0),
           serial_port_(io_serial_),
+          serial_strand_(io_serial_),
+          serial_work_(io_serial_),
           i2c_(io_i2c_)
     {
-        start(serial, i2c);
+        for (auto & shard : shards_)
+        {
+            shard.entries = History(capacity, t_s);
+            shard.archive = Archive(ARCHIVE_CAPACITY, t_s);
+            shard.tracking_error = TDigest(TDIGEST_COMPRESSION);
+            shard.duty_cycle = TDigest(TDIGEST_COMPRESSION);
+        }
+        reset();
     }
 
     /**
@@ -170,7 +316,7 @@ public:
         auto now_ms = std::chrono::time_point_cast<std::chrono::milliseconds>(now);
         auto value = now_ms.time_since_epoch();
         unsigned long absolute = value.count();
-        unsigned long relative = absolute - start_;
+        unsigned long relative = absolute - start_.load();
         return relative;
     }
 
@@ -192,7 +338,9 @@ public:
     /**
      * @brief      Resets the system.
      * 
-     * Resets the physical system and clears logs.
+     * Resets the physical system and clears logs. Concurrent resets are
+     * serialised. The new session starts a new journal, the former one kept
+     * with the JOURNAL_PREVIOUS suffix.
      * 
      */
     void reset();
@@ -207,6 +355,44 @@ public:
      */
     void runSerial();
 
+    /**
+     * @brief      Opens the journal every inserted sample is appended to.
+     *
+     * A reset marker starts each session recorded in the journal. When
+     * restoring, the latest session is instead replayed into the logs and
+     * metrics, and continued with its original time reference. Otherwise,
+     * the new session starts a new journal, as on reset.
+     *
+     * @param[in]  path     The journal file path
+     * @param[in]  restore  Whether to resume the latest session
+     *
+     * @return     True on success, false otherwise.
+     */
+    bool openJournal(const std::string & path, bool restore = true);
+
+    /**
+     * @brief      Run the journal sync stage.
+     *
+     * Flushes the journal to disk every JOURNAL_SYNC_PERIOD, off the
+     * ingest path.
+     */
+    void runJournal();
+
+    /**
+     * @brief      Run the export worker.
+     *
+     * Runs queued exports one at a time, off the request handling threads.
+     */
+    void runExport();
+
+    /**
+     * @brief      Run the commit stage.
+     *
+     * Drains samples queued by the I2C thread into the log, in batches of
+     * up to COMMIT_BATCH.
+     */
+    void runCommit();
+
     /**
      * @brief      Starts an I2C read.
      */
@@ -222,12 +408,22 @@ public:
         size_t bytes_transferred);
 
     /**
-     * @brief      Starts a write to Serial.
+     * @brief      Queues a message for Serial.
+     *
+     * May be called from any thread. Messages are written in order, one at
+     * a time, by the Serial I/O service.
      *
      * @param[in]  msg   The message
      */
     void startWriteSerial(const std::string & msg);
 
+    /**
+     * @brief      Starts the write of the first queued message to Serial.
+     *
+     * Must run on the Serial strand.
+     */
+    void writeSerial();
+
     /**
      * @brief      Handles a write to Serial
      *
@@ -240,13 +436,19 @@ public:
     /**
      * @brief      Inserts an entry in the log.
      *
-     * @param[in]  id             The identifier
-     * @param[in]  timestamp      The timestamp
-     * @param[in]  lux            The lux
-     * @param[in]  duty_cycle     The duty cycle
-     * @param[in]  lux_reference  The lux reference
-     * @param[in]  c_err          The c error
-     * @param[in]  c_var          The c variable
+     * Updates the node's running metrics and the system totals, and stores
+     * the resulting comfort error and variance alongside the measurements.
+     * Entries exceeding the retention policy are discarded.
+     * Finally, publishes the node's latest state.
+     *
+     * @param[in]  id               The identifier
+     * @param[in]  timestamp        The timestamp
+     * @param[in]  lux              The lux
+     * @param[in]  duty_cycle       The duty cycle
+     * @param[in]  lux_reference    The lux reference
+     * @param[in]  lux_lower_bound  The lux lower bound
+     * @param[in]  lux_external     The external lux
+     * @param[in]  occupancy        The occupancy
      */
     void insertEntry(
         size_t id,
@@ -254,40 +456,82 @@ public:
         float lux,
         float duty_cycle,
         float lux_reference,
-        float c_err,
-        float c_var);
+        float lux_lower_bound = 0,
+        float lux_external = 0,
+        bool occupancy = false);
+
+    /**
+     * @brief      Inserts a batch of samples in the log.
+     *
+     * Equivalent to calling insertEntry for each sample. Only the lock of
+     * the node being updated is held, once per run of consecutive samples
+     * from that node, so other nodes remain readable. Samples are appended
+     * to the journal, if open, beforehand.
+     *
+     * @param[in]  samples  The samples
+     * @param[in]  count    The number of samples
+     */
+    void insertEntries(const Sample *samples, size_t count);
 
     /**
-     * @brief      Saves entries to disk.
+     * @brief      Saves entries to disk, in the background.
+     *
+     * Queues an export of the current session, as journaled so far, to one
+     * file per node. The journal is flushed first.
+     *
+     * @param[in]  format     The output format
+     * @param[in]  directory  The output directory
+     *
+     * @return     The queued export, or null if there is no journal.
      */
-    void saveEntries();
+    ExportJob::ptr saveEntries(
+        ExportJob::Format format = ExportJob::CSV,
+        const std::string & directory = ".");
 
     /* Get */
 
     /**
-     * @brief      Gets the latest entry.
+     * @brief      Gets a copy of the latest entry.
      *
-     * @param[in]  id    The node identifier
+     * @param[in]  id     The node identifier
+     * @param      entry  The output entry
      *
-     * @return     The latest entry.
+     * @return     True if the node has any entry, false otherwise.
      */
-    Entry *getLatestEntry(size_t id);
+    bool getLatestEntry(size_t id, Entry & entry);
+
+    /**
+     * @brief      Gets a consistent copy of every node's state and the totals.
+     *
+     * Each node's state is copied consistently, in a single pass, and the
+     * totals are the sum of the shares in the states returned.
+     *
+     * @param      states  The output state of each node
+     * @param      totals  The output totals
+     */
+    void getSnapshot(std::vector< NodeState > & states, Totals & totals);
 
     /**
      * @brief      Gets the values of lux or duty cycle in a time period.
      *
-     * @param[in]  id        The node identifier
-     * @param[in]  start     The start
-     * @param[in]  end       The end
-     * @param[in]  var       The variable (LUX | DUTY_CYCLE)
-     * @param      response  The output string with comma-separated values
+     * Raw entries are returned unless a resolution of at least 1 s is
+     * requested, in which case the means of the coarsest rollup buckets not
+     * exceeding it are returned instead.
+     *
+     * @param[in]  id          The node identifier
+     * @param[in]  start       The start
+     * @param[in]  end         The end
+     * @param[in]  var         The variable (LUX | DUTY_CYCLE)
+     * @param      response    The output string with comma-separated values
+     * @param[in]  resolution  The maximum spacing between values (ms)
      */
     void getValuesInPeriod(
         size_t id,
         unsigned long start,
         unsigned long end,
         char var,
-        std::string & response);
+        std::string & response,
+        unsigned long resolution = 0);
 
     /**
      * @brief      Gets the latest lux value for a given desk.
@@ -354,7 +598,7 @@ public:
     float getPower(size_t id, bool total);
 
     /**
-     * @brief      Computes the energy for a given node.
+     * @brief      Obtains the accumulated energy for a given node.
      *
      * @param[in]  id    The node identifier
      *
@@ -365,15 +609,16 @@ public:
     /**
      * @brief      Gets the energy for a given desk or total energy.
      *
-     * @param[in]  id     The node identifier
-     * @param[in]  total  Whether to calculate total energy
+     * @param[in]  id      The node identifier
+     * @param[in]  total   Whether to calculate total energy
+     * @param[in]  window  The period up to now to consider (ms), 0 since reset
      *
      * @return     The energy.
      */
-    float getEnergy(size_t id, bool total);
+    float getEnergy(size_t id, bool total, unsigned long window = 0);
 
     /**
-     * @brief      Computes the comfort error for a given node.
+     * @brief      Obtains the average comfort error for a given node.
      *
      * @param[in]  id    The node identifier
      *
@@ -384,31 +629,68 @@ public:
     /**
      * @brief      Gets the comfort error for a given desk or total comfort error.
      *
-     * @param[in]  id     The node identifier
-     * @param[in]  total  Whether to calculate total comfort error
+     * @param[in]  id      The node identifier
+     * @param[in]  total   Whether to calculate total comfort error
+     * @param[in]  window  The period up to now to consider (ms), 0 since reset
      *
      * @return     The comfort error.
      */
-    float getComfortError(size_t id, bool total);
+    float getComfortError(size_t id, bool total, unsigned long window = 0);
 
     /**
-     * @brief      Computes the comfort error for a given node.
+     * @brief      Obtains the average comfort variance for a given node.
      *
      * @param[in]  id    The node identifier
      *
-     * @return     The comfort error.
+     * @return     The comfort variance.
      */
     float comfortVarianceNode(size_t id);
 
     /**
      * @brief      Gets the comfort variance for a given desk or total comfort variance.
      *
-     * @param[in]  id     The node identifier
-     * @param[in]  total  Whether to calculate total comfort variance
+     * @param[in]  id      The node identifier
+     * @param[in]  total   Whether to calculate total comfort variance
+     * @param[in]  window  The period up to now to consider (ms), 0 since reset
      *
      * @return     The comfort variance.
      */
-    float getComfortVariance(size_t id, bool total);
+    float getComfortVariance(size_t id, bool total, unsigned long window = 0);
+
+    /**
+     * @brief      Runs a query over the stored entries of its nodes.
+     *
+     * Each node is scanned under its own lock, cold log first.
+     *
+     * @param[in]  query    The query
+     * @param      buckets  The output buckets, one per query bucket
+     *
+     * @return     True on success, false if a node does not exist.
+     */
+    bool query(const Query & query, std::vector< QueryBucket > & buckets);
+
+    /**
+     * @brief      Gets quantiles of the tracking error or duty cycle for a
+     *             given desk, or across every desk.
+     *
+     * Estimated from per-node sketches updated on insertion, which are merged
+     * for the system-wide distribution.
+     *
+     * @param[in]  id         The node identifier
+     * @param[in]  total      Whether to merge every node
+     * @param[in]  var        The variable (COMFORT_ERR | DUTY_CYCLE)
+     * @param[in]  quantiles  The quantiles, in [0, 1]
+     * @param      values     The output values, one per quantile, -1 if no
+     *                        entry was registered
+     *
+     * @return     True on success, false if a node does not exist.
+     */
+    bool getQuantiles(
+        size_t id,
+        bool total,
+        char var,
+        const std::vector< double > & quantiles,
+        std::vector< double > & values);
 
     /**
      * @brief      Gets the time since last reset for a given node.
@@ -418,6 +700,50 @@ public:
      * @return     The time since last reset.
      */
     unsigned long getTimestamp(size_t id);
+
+private:
+
+    /**
+     * @brief      Inserts a sample in its node's log, with the node lock held.
+     *
+     * @param      shard   The node's store
+     * @param[in]  sample  The sample
+     */
+    void insertLocked(NodeStore & shard, const Sample & sample);
+
+    /**
+     * @brief      Obtains a node's metrics over a recent window.
+     *
+     * Computed as the difference between the running metrics and those
+     * prior to the first entry in the window, found by a binary search over
+     * the hot history and a replay of at most one checkpoint interval, so
+     * O(log n) in its size. Windows reaching past the oldest hot entry are
+     * clamped to it.
+     *
+     * @param[in]  id      The node identifier
+     * @param[in]  window  The period up to now (ms)
+     *
+     * @return     The metrics of the entries in the window.
+     */
+    Metrics windowNode(size_t id, unsigned long window);
+
+    /**
+     * @brief      Replays the latest session of a journal.
+     *
+     * Each replay thread reads the journal through its own view.
+     *
+     * @param[in]  journal  The journal
+     *
+     * @return     True if a session was restored, false otherwise.
+     */
+    bool restore(const JournalReader & journal);
+
+    /**
+     * @brief      Sums every node's share of the totals.
+     *
+     * @return     The totals.
+     */
+    Totals loadTotals() const;
 };
 
 #endif
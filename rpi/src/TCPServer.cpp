@@ -10,14 +10,14 @@
 
 void TCPServer::startAccept()
 {
-    TCPSession* new_session = new TCPSession(acceptor_.get_io_service(), system_);
+    TCPSession::ptr new_session(new TCPSession(io_service_, system_));
 
     acceptor_.async_accept(new_session->socket(),
         boost::bind(& TCPServer::handleAccept, this, new_session,
             boost::asio::placeholders::error));
 }
 
-void TCPServer::handleAccept(TCPSession *new_session,
+void TCPServer::handleAccept(TCPSession::ptr new_session,
     const boost::system::error_code & error)
 {  
     if (!error)
@@ -25,8 +25,4 @@ void TCPServer::handleAccept(TCPSession *new_session,
         new_session->start();
         startAccept();
     }
-    else
-    {
-        delete new_session;
-    }
 }
\ No newline at end of file
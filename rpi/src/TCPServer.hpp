@@ -28,6 +28,8 @@ class TCPServer
 
 private:
 
+    /** I/O service shared by the sessions */
+    boost::asio::io_service & io_service_;
     /** TCP session acceptor */
     tcp::acceptor acceptor_;
     /** System pointer */
@@ -38,6 +40,8 @@ public:
     /**
      * @brief      Constructor
      *
+     * The i/o service may be run by several threads at once.
+     *
      * @param      io_service  The i/o service
      * @param      port        The TCP port for incoming connections
      * @param[in]  system      The system
@@ -46,7 +50,8 @@ public:
         boost::asio::io_service & io_service,
         unsigned short port,
         System::ptr system)
-        : acceptor_(io_service, tcp::endpoint(tcp::v4(), port))
+        : io_service_(io_service),
+          acceptor_(io_service, tcp::endpoint(tcp::v4(), port))
     {
         system_ = system;
         startAccept();
@@ -62,7 +67,7 @@ private:
     /**
      * @brief      Handles and accept attempt
      */
-    void handleAccept(TCPSession *new_session,
+    void handleAccept(TCPSession::ptr new_session,
       const boost::system::error_code & error);
 };
 
@@ -10,21 +10,24 @@
 
 void TCPSession::start()
 {
+    // Responses are written whole, so there is nothing to coalesce
+    boost::system::error_code ignored;
+    socket_.set_option(tcp::no_delay(true), ignored);
     // Start the receiver actor and recv send loop
     startRead();
     // Start the timer
     timer_.expires_from_now(boost::posix_time::milliseconds(STREAM_PERIOD));
-    timer_.async_wait(boost::bind(& TCPSession::handleTimer, this,
-        boost::asio::placeholders::error));
+    timer_.async_wait(strand_.wrap(boost::bind(& TCPSession::handleTimer,
+        shared_from_this(), boost::asio::placeholders::error)));
 }
 
 void TCPSession::startRead()
 {
-    memset(recv_buffer_, '\0', RECV_BUFFER);
-    socket_.async_read_some(boost::asio::buffer(recv_buffer_, RECV_BUFFER),
-        boost::bind(& TCPSession::handleRead, this, 
+    size_t space = recv_stream_.max_size() - recv_stream_.size();
+    socket_.async_read_some(recv_stream_.prepare(space),
+        strand_.wrap(boost::bind(& TCPSession::handleRead, shared_from_this(),
             boost::asio::placeholders::error,
-            boost::asio::placeholders::bytes_transferred));
+            boost::asio::placeholders::bytes_transferred)));
 }
 
 void TCPSession::handleRead(const boost::system::error_code & error,
@@ -32,119 +35,177 @@ void TCPSession::handleRead(const boost::system::error_code & error,
 {
     if (!error)
     {
+        recv_stream_.commit(bytes_transferred);
+        size_t queued = outbox_.size();
 
-        if (bytes_transferred > 1)
+        // The first byte selects the protocol for the whole session
+        if (protocol_ == PROTOCOL_UNKNOWN)
         {
-            debugPrintTrace("Received " << bytes_transferred << " bytes: " << recv_buffer_);
+            const char *first = static_cast< const char * >(recv_stream_.data().data());
+            if ((uint8_t) first[0] == BINARY_HANDSHAKE)
+            {
+                protocol_ = PROTOCOL_BINARY;
+                recv_stream_.consume(1);
+                outbox_ += (char) BINARY_HANDSHAKE;
+            }
+            else
+            {
+                protocol_ = PROTOCOL_TEXT;
+            }
         }
 
-        size_t length = 0;
-        char *request_str = std::strtok(recv_buffer_, DELIMETER_STR);
-        
-        memset(send_buffer_, '\0', SEND_BUFFER);
-        
-        if (request_str)
-        {
-            std::string response;
-            std::string request(request_str);
-
-            parseRequest(system_, last_update_, flags_, request, response);
-
-            length = (response.size() < SEND_BUFFER - 1)? response.size() : SEND_BUFFER - 1;
-            strncpy(send_buffer_, response.c_str(), length);
-            send_buffer_[length + 1] = MSG_DELIMETER;
-        }
-        else
+        // Every complete request is answered, in a single write
+        const char *data = static_cast< const char * >(recv_stream_.data().data());
+        size_t size = recv_stream_.size();
+        size_t used = (protocol_ == PROTOCOL_BINARY)?
+            readBinary(reinterpret_cast< const uint8_t * >(data), size) :
+            readText(data, size);
+        // A partial request is kept for the next read
+        recv_stream_.consume(used);
+        if (recv_stream_.size() == recv_stream_.max_size())
         {
-            // Ignore non-terminated or empty messages (e.g. heartbeat)
-            send_buffer_[length] = MSG_DELIMETER;
+            close(boost::asio::error::message_size);
+            return;
         }
 
-        if (length > 0)
+        if (outbox_.size() == queued)
         {
-            debugPrintTrace("Sending: " << send_buffer_);
-        } 
-
+            startRead();
+            return;
+        }
+        // Reading resumes once the responses are written
+        read_paused_ = true;
         startWrite();
     }
     else
     {
-        if (error == boost::asio::error::eof)
-            debugPrintTrace("Connection closed");
-        else
-            errPrintTrace(error.message());
-        delete this;
+        close(error);
     }
 }
 
-void TCPSession::startWrite()
+size_t TCPSession::readText(const char *data, size_t size)
 {
-    boost::asio::async_write(socket_, boost::asio::buffer(send_buffer_, SEND_BUFFER),
-        boost::bind(& TCPSession::handleWrite, this,
-            boost::asio::placeholders::error,
-            boost::asio::placeholders::bytes_transferred));
+    const char *end = data + size;
+    const char *request_str = data;
+    const char *delimiter;
+    while ((delimiter = static_cast< const char * >(
+        memchr(request_str, MSG_DELIMETER, end - request_str))))
+    {
+        // Responses are formatted straight into the output buffer
+        if (delimiter != request_str)
+        {
+            boost::string_view request(request_str, delimiter - request_str);
+            size_t start = outbox_.size();
+            debugPrintTrace("Received: " << request);
+            dispatchRequest(system_, last_update_, flags_, export_job_, request, outbox_);
+            debugPrintTrace("Sending: "
+                << boost::string_view(outbox_.data() + start, outbox_.size() - start));
+        }
+        // Empty messages (e.g. heartbeat) get an empty response
+        outbox_ += MSG_DELIMETER;
+        request_str = delimiter + 1;
+    }
+    return request_str - data;
 }
 
-void TCPSession::handleWrite(const boost::system::error_code & error,
-    size_t bytes_transferred)
+size_t TCPSession::readBinary(const uint8_t *data, size_t size)
 {
-    if (!error)
+    // Frames are answered in order, straight into the output buffer
+    size_t used = 0;
+    while (size - used >= BINARY_LENGTH_SIZE)
     {
-        startRead();
-    }
-    else
-    {
-        if (error == boost::asio::error::eof)
-            debugPrintTrace("Connection closed");
-        else
-            errPrintTrace(error.message());
-        delete this;
+        size_t length = data[used] | (data[used + 1] << 8);
+        if (size - used - BINARY_LENGTH_SIZE < length)
+        {
+            break;
+        }
+        parseBinaryRequest(system_, last_update_, flags_,
+            data + used + BINARY_LENGTH_SIZE, length, outbox_);
+        used += BINARY_LENGTH_SIZE + length;
     }
+    return used;
 }
 
-void TCPSession::startStreamWrite()
+void TCPSession::startWrite()
 {
-    boost::asio::async_write(socket_, boost::asio::buffer(stream_buffer_, SEND_BUFFER),
-        boost::bind(& TCPSession::handleStreamWrite, this,
+    if (writing_ || outbox_.empty())
+    {
+        return;
+    }
+
+    // The buffers are swapped, keeping their capacity for the next responses
+    sending_.swap(outbox_);
+    writing_ = true;
+    boost::asio::async_write(socket_, boost::asio::buffer(sending_),
+        strand_.wrap(boost::bind(& TCPSession::handleWrite, shared_from_this(),
             boost::asio::placeholders::error,
-            boost::asio::placeholders::bytes_transferred));
+            boost::asio::placeholders::bytes_transferred)));
 }
 
-void TCPSession::handleStreamWrite(const boost::system::error_code & error,
+void TCPSession::handleWrite(const boost::system::error_code & error,
     size_t bytes_transferred)
 {
-    if (error)
+    if (!error)
+    {
+        writing_ = false;
+        sending_.clear();
+        if (!outbox_.empty())
+        {
+            // Stream updates queued meanwhile
+            startWrite();
+        }
+        else if (read_paused_)
+        {
+            read_paused_ = false;
+            startRead();
+        }
+    }
+    else
     {
-        if (error == boost::asio::error::eof)
-            debugPrintTrace("Connection closed");
-        else
-            errPrintTrace(error.message());
-        delete this;
+        close(error);
     }
 }
 
 void TCPSession::handleTimer(const boost::system::error_code & error)
 {
     
-    if (!error)
+    if (!error && socket_.is_open())
     {
-        // Obtain stream string
+        // Obtain stream string, streams being only requested in text
         std::string response;
-        streamUpdate(system_, last_update_, flags_, response); 
+        if (protocol_ == PROTOCOL_TEXT)
+        {
+            streamUpdate(system_, last_update_, flags_, export_job_, response);
+        }
         
         if (!response.empty())
         {
-            memset(stream_buffer_, '\0', SEND_BUFFER);
-            size_t length = (response.size() < SEND_BUFFER - 1)? response.size() : SEND_BUFFER - 1;
-            strncpy(stream_buffer_, response.c_str(), length);
-            stream_buffer_[length + 1] = MSG_DELIMETER;
-            startStreamWrite();
+            outbox_ += response;
+            outbox_ += MSG_DELIMETER;
+            startWrite();
         }
 
         // Reschedule the timer
         timer_.expires_at(timer_.expires_at() + boost::posix_time::milliseconds(STREAM_PERIOD));
         // Post the timer event
-        timer_.async_wait(boost::bind(& TCPSession::handleTimer, this,
-            boost::asio::placeholders::error));
+        timer_.async_wait(strand_.wrap(boost::bind(& TCPSession::handleTimer,
+            shared_from_this(), boost::asio::placeholders::error)));
     }
 }
+
+void TCPSession::close(const boost::system::error_code & error)
+{
+    if (!socket_.is_open())
+    {
+        return;
+    }
+    if (error == boost::asio::error::eof)
+        debugPrintTrace("Connection closed");
+    else
+        errPrintTrace(error.message());
+
+    // Pending operations are aborted and release the session
+    boost::system::error_code ignored;
+    socket_.close(ignored);
+    timer_.cancel(ignored);
+}
@@ -8,8 +8,14 @@
 
 #include <iostream>
 #include <ctime>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
 
 using boost::asio::ip::tcp;
 
@@ -20,18 +26,45 @@ using boost::asio::ip::tcp;
 
 /**
  * @brief      Class for TCP session.
+ *
+ * Sessions are served by a pool of threads, so every handler of a session
+ * runs through its strand and holds a reference to it, which is released
+ * once the socket is closed and no operation is pending.
  */
-class TCPSession
+class TCPSession : public boost::enable_shared_from_this< TCPSession >
 {
 
+public:
+
+    /** Shared pointer to TCP session */
+    typedef boost::shared_ptr< TCPSession > ptr;
+
+    /** Request protocols */
+    enum Protocol
+    {
+        PROTOCOL_UNKNOWN = 0,
+        PROTOCOL_TEXT,
+        PROTOCOL_BINARY
+    };
+
 private:
 
     /** TCP Socket */
     tcp::socket socket_;
-    /** Request buffer */
-    char recv_buffer_[RECV_BUFFER];
-    /** Response buffer */
-    char send_buffer_[SEND_BUFFER];
+    /** Strand serialising the session's handlers */
+    boost::asio::io_service::strand strand_;
+    /** Request buffer, holding at most one partial request after a read */
+    boost::asio::streambuf recv_stream_;
+    /** Protocol, selected by the first byte received */
+    Protocol protocol_;
+    /** Responses waiting to be written, formatted in place */
+    std::string outbox_;
+    /** Responses being written */
+    std::string sending_;
+    /** Whether a write is in progress */
+    bool writing_;
+    /** Whether reading waits for the last commands' responses to be written */
+    bool read_paused_;
     /** System pointer */
     System::ptr system_;
 
@@ -43,8 +76,8 @@ private:
     std::vector< bool > flags_;
     /** Timer */
     boost::asio::deadline_timer timer_;
-    /** Stream buffer */
-    char stream_buffer_[SEND_BUFFER];
+    /** Export requested by this session, reported by the stream */
+    ExportJob::ptr export_job_;
 
 public:
 
@@ -56,11 +89,18 @@ public:
      */
     TCPSession(boost::asio::io_service & io_service, System::ptr system)
         :   socket_(io_service),
+            strand_(io_service),
+            recv_stream_(RECV_BUFFER),
+            protocol_(PROTOCOL_UNKNOWN),
+            writing_(false),
+            read_paused_(false),
             flags_(STREAM_FLAGS * system->getNodes()),
             last_update_(system->getNodes()),
             timer_(io_service)
     {
         system_ = system;
+        outbox_.reserve(SEND_BUFFER);
+        sending_.reserve(SEND_BUFFER);
     }
 
     ~TCPSession()
@@ -91,39 +131,46 @@ private:
     void startRead();
 
     /**
-     * @brief      Handles a read.
+     * @brief      Handles a read of one or more requests.
      *
-     * @param[in]  error  The error code
+     * @param[in]  error              The error code
+     * @param[in]  bytes_transferred  The bytes transferred
      */
     void handleRead(const boost::system::error_code & error,
         size_t bytes_transferred);
 
     /**
-     * @brief      Starts a write.
+     * @brief      Answers the complete newline-terminated text commands.
+     *
+     * @param[in]  data  The received data
+     * @param[in]  size  The received data size
+     *
+     * @return     The number of bytes used.
      */
-    void startWrite();
+    size_t readText(const char *data, size_t size);
 
     /**
-     * @brief      Handles a write response.
+     * @brief      Answers the complete length-prefixed binary frames.
      *
-     * @param[in]  error                The error code
-     * @param[in]  bytes_transferred    The bytes transferred
+     * @param[in]  data  The received data
+     * @param[in]  size  The received data size
+     *
+     * @return     The number of bytes used.
      */
-    void handleWrite(const boost::system::error_code & error,
-        size_t bytes_transferred);
+    size_t readBinary(const uint8_t *data, size_t size);
 
     /**
-     * @brief      Starts a stream write.
+     * @brief      Starts writing the queued responses, unless already writing.
      */
-    void startStreamWrite();
+    void startWrite();
 
     /**
-     * @brief      Handles a write stream.
+     * @brief      Handles a write response.
      *
-     * @param[in]  error              The error code
-     * @param[in]  bytes_transferred  The bytes transferred
+     * @param[in]  error                The error code
+     * @param[in]  bytes_transferred    The bytes transferred
      */
-    void handleStreamWrite(const boost::system::error_code & error,
+    void handleWrite(const boost::system::error_code & error,
         size_t bytes_transferred);
 
     /**
@@ -131,4 +178,11 @@ private:
      */
     void handleTimer(const boost::system::error_code & error);
 
+    /**
+     * @brief      Closes the session on a failed operation.
+     *
+     * @param[in]  error  The error code
+     */
+    void close(const boost::system::error_code & error);
+
 };
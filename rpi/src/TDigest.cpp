@@ -0,0 +1,160 @@
+/**
+ * @file    rpi/src/TDigest.cpp
+ *
+ * @brief   Streaming quantile sketch implementation
+ *
+ * Summarises a stream of values as a merging t-digest (Dunning and Ertl):
+ * values are buffered and periodically merged into a bounded set of
+ * centroids, smaller near the tails, so that extreme quantiles stay accurate
+ * in constant memory. Digests of different streams can be merged.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#include "TDigest.hpp"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace
+{
+    /**
+     * @brief      Maps a quantile to the k1 scale, arcsine shaped so that
+     *             centroids near the tails cover fewer values.
+     *
+     * @param[in]  q            The quantile
+     * @param[in]  compression  The compression
+     *
+     * @return     The scale value.
+     */
+    double scale(double q, double compression)
+    {
+        return compression / (2 * M_PI) * std::asin(2 * q - 1);
+    }
+
+    /**
+     * @brief      Maps a k1 scale value back to a quantile.
+     *
+     * @param[in]  k            The scale value
+     * @param[in]  compression  The compression
+     *
+     * @return     The quantile.
+     */
+    double scaleInverse(double k, double compression)
+    {
+        return (std::sin(std::min(k * 2 * M_PI / compression, M_PI / 2)) + 1) / 2;
+    }
+}
+
+TDigest::TDigest(double compression)
+    : compression_(compression),
+      buffer_capacity_((size_t) compression)
+{
+    centroids_.reserve((size_t) compression + 1);
+    buffer_.reserve(buffer_capacity_ + centroids_.capacity());
+    clear();
+}
+
+void TDigest::clear()
+{
+    centroids_.clear();
+    buffer_.clear();
+    total_ = 0;
+    min_ = std::numeric_limits< double >::infinity();
+    max_ = -std::numeric_limits< double >::infinity();
+}
+
+void TDigest::add(double x)
+{
+    if (std::isnan(x)) return;
+    min_ = std::min(min_, x);
+    max_ = std::max(max_, x);
+    push(Centroid{x, 1});
+}
+
+void TDigest::merge(const TDigest & other)
+{
+    if (other.total_ == 0) return;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+    for (const Centroid & c : other.centroids_) push(c);
+    for (const Centroid & c : other.buffer_) push(c);
+}
+
+void TDigest::push(const Centroid & c)
+{
+    if (buffer_.size() >= buffer_capacity_) compress();
+    buffer_.push_back(c);
+    total_ += c.weight;
+}
+
+void TDigest::compress()
+{
+    if (buffer_.empty()) return;
+
+    // Merge the sorted union of centroids and buffer in a single pass,
+    // growing each centroid while it spans at most one unit of k.
+    // Centroids are already sorted, so only the buffer needs sorting.
+    std::sort(buffer_.begin(), buffer_.end());
+    size_t buffered = buffer_.size();
+    buffer_.insert(buffer_.end(), centroids_.begin(), centroids_.end());
+    std::inplace_merge(buffer_.begin(), buffer_.begin() + buffered, buffer_.end());
+    centroids_.clear();
+
+    Centroid current = buffer_[0];
+    double merged = 0;
+    double limit = total_ * scaleInverse(scale(0, compression_) + 1, compression_);
+    for (size_t i = 1; i < buffer_.size(); i++)
+    {
+        const Centroid & next = buffer_[i];
+        if (merged + current.weight + next.weight <= limit)
+        {
+            current.weight += next.weight;
+            current.mean += (next.mean - current.mean) * next.weight / current.weight;
+        }
+        else
+        {
+            merged += current.weight;
+            centroids_.push_back(current);
+            limit = total_ * scaleInverse(
+                scale(merged / total_, compression_) + 1, compression_);
+            current = next;
+        }
+    }
+    centroids_.push_back(current);
+    buffer_.clear();
+}
+
+double TDigest::quantile(double q)
+{
+    compress();
+    if (centroids_.empty()) return std::numeric_limits< double >::quiet_NaN();
+    q = std::min(std::max(q, 0.0), 1.0);
+
+    // Interpolate between centroid centres, and towards the extremes
+    // outside the first and last centres
+    double index = q * total_;
+    double centre = centroids_[0].weight / 2;
+    if (index <= centre)
+    {
+        return min_ + (centroids_[0].mean - min_) * index / centre;
+    }
+    double cumulative = centroids_[0].weight;
+    for (size_t i = 1; i < centroids_.size(); i++)
+    {
+        double next = cumulative + centroids_[i].weight / 2;
+        if (index <= next)
+        {
+            double f = (index - centre) / (next - centre);
+            return centroids_[i - 1].mean
+                + f * (centroids_[i].mean - centroids_[i - 1].mean);
+        }
+        centre = next;
+        cumulative += centroids_[i].weight;
+    }
+    const Centroid & last = centroids_.back();
+    double f = (index - centre) / (total_ - centre);
+    return last.mean + f * (max_ - last.mean);
+}
@@ -0,0 +1,129 @@
+/**
+ * @file    rpi/src/TDigest.hpp
+ *
+ * @brief   Streaming quantile sketch headers
+ *
+ * Summarises a stream of values as a merging t-digest (Dunning and Ertl):
+ * values are buffered and periodically merged into a bounded set of
+ * centroids, smaller near the tails, so that extreme quantiles stay accurate
+ * in constant memory. Digests of different streams can be merged.
+ *
+ * @author  João Borrego
+ *
+ */
+
+#ifndef TDIGEST_HPP
+#define TDIGEST_HPP
+
+#include <vector>
+#include <cstddef>
+
+/**
+ * @brief      Class for a t-digest quantile sketch.
+ */
+class TDigest
+{
+
+private:
+
+    /**
+     * @brief      Class for a cluster of values.
+     */
+    class Centroid
+    {
+
+    public:
+
+        /** Mean of the clustered values */
+        double mean;
+        /** Number of clustered values */
+        double weight;
+
+        /**
+         * @brief      Orders centroids by mean.
+         *
+         * @param[in]  other  The other centroid
+         *
+         * @return     True if this centroid precedes the other.
+         */
+        bool operator<(const Centroid & other) const { return mean < other.mean; }
+    };
+
+    /** Compression, bounding the number of centroids */
+    double compression_;
+    /** Merged centroids, sorted by mean */
+    std::vector< Centroid > centroids_;
+    /** Values not yet merged */
+    std::vector< Centroid > buffer_;
+    /** Maximum number of values buffered before merging */
+    size_t buffer_capacity_;
+    /** Total weight, merged and buffered */
+    double total_;
+    /** Smallest value */
+    double min_;
+    /** Largest value */
+    double max_;
+
+public:
+
+    /**
+     * @brief      Constructs an empty digest.
+     *
+     * @param[in]  compression  The compression, roughly the maximum number
+     *                          of centroids
+     */
+    explicit TDigest(double compression = 100);
+
+    /**
+     * @brief      Removes every value.
+     */
+    void clear();
+
+    /**
+     * @brief      Gets the number of summarised values.
+     *
+     * @return     The count.
+     */
+    double count() const { return total_; }
+
+    /**
+     * @brief      Adds a value.
+     *
+     * @param[in]  x     The value
+     */
+    void add(double x);
+
+    /**
+     * @brief      Adds every value summarised by another digest.
+     *
+     * @param[in]  other  The other digest
+     */
+    void merge(const TDigest & other);
+
+    /**
+     * @brief      Merges buffered values into the centroids.
+     */
+    void compress();
+
+    /**
+     * @brief      Estimates a quantile.
+     *
+     * Buffered values are merged first.
+     *
+     * @param[in]  q     The quantile, in [0, 1]
+     *
+     * @return     The value, or NaN if the digest is empty.
+     */
+    double quantile(double q);
+
+private:
+
+    /**
+     * @brief      Buffers a weighted value, merging when the buffer is full.
+     *
+     * @param[in]  c     The centroid
+     */
+    void push(const Centroid & c);
+};
+
+#endif
@@ -0,0 +1,604 @@
+/**
+ * @file    rpi/src/analyse.cpp
+ *
+ * @brief   Offline run analysis tool
+ *
+ * Computes the performance metrics of captured runs, as the server does
+ * (energy, comfort error and comfort variance, per node and in total), and
+ * compares every run against the first, as in the MATLAB analysis scripts.
+ *
+ * A run is either a server journal, whose latest session is replayed, or a
+ * set of per-node exports: CSV (.csv) or columnar (.col) files named
+ * <dir>/<id> or <prefix>_<id>. Runs, and the nodes of exported runs, are
+ * analysed in parallel.
+ *
+ * @author  João Borrego
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "constants.hpp"
+#include "Metrics.hpp"
+#include "Journal.hpp"
+#include "JournalExport.hpp"
+
+namespace
+{
+    /** Exported node files are searched up to this identifier */
+    const size_t MAX_NODES = 256;
+
+    /**
+     * @brief      Class for the CSV columns holding each variable.
+     */
+    class CsvLayout
+    {
+
+    public:
+
+        /** Timestamp column (ms) */
+        size_t timestamp;
+        /** Measured illuminance column */
+        size_t lux;
+        /** Duty cycle column */
+        size_t duty_cycle;
+        /** Reference illuminance column */
+        size_t lux_reference;
+
+        /**
+         * @brief      Constructs the layout of the server's CSV export.
+         */
+        CsvLayout() : timestamp(0), lux(1), duty_cycle(2), lux_reference(3) {}
+    };
+
+    /**
+     * @brief      Class for a node's metrics in a run.
+     */
+    class NodeResult
+    {
+
+    public:
+
+        /** Number of samples */
+        size_t samples;
+        /** Metrics over every sample */
+        Metrics metrics;
+
+        NodeResult() : samples(0) {}
+    };
+
+    /**
+     * @brief      Class for a captured run.
+     */
+    class Run
+    {
+
+    public:
+
+        /** Path given on the command line */
+        std::string name;
+        /** Journal path, if the run is a journal */
+        std::string journal;
+        /** Node export paths, if the run is exported */
+        std::vector< std::string > files;
+        /** Sampling period (s) */
+        float sample_period;
+        /** Per node results */
+        std::vector< NodeResult > nodes;
+        /** Whether every input was read */
+        bool ok;
+
+        Run() : sample_period(T_S), ok(true) {}
+    };
+
+    /**
+     * @brief      Class for a unit of work: a journal, or one node's export.
+     */
+    class Task
+    {
+
+    public:
+
+        /** Run index */
+        size_t run;
+        /** Node index, for exported runs */
+        size_t node;
+    };
+
+    /**
+     * @brief      Checks whether a file exists.
+     *
+     * @param[in]  path  The path
+     *
+     * @return     True if it is a regular file, false otherwise.
+     */
+    bool isFile(const std::string & path)
+    {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+    }
+
+    /**
+     * @brief      Checks whether a directory exists.
+     *
+     * @param[in]  path  The path
+     *
+     * @return     True if it is a directory, false otherwise.
+     */
+    bool isDirectory(const std::string & path)
+    {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+
+    /**
+     * @brief      Reads a whole file.
+     *
+     * @param[in]  path  The path
+     * @param      data  The contents
+     *
+     * @return     True on success, false otherwise.
+     */
+    bool readFile(const std::string & path, std::vector< char > & data)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) return false;
+        data.resize(file.tellg());
+        file.seekg(0);
+        return (bool) file.read(data.data(), data.size());
+    }
+
+    /**
+     * @brief      Replays a node's CSV export.
+     *
+     * @param[in]  path    The path
+     * @param[in]  layout  The columns holding each variable
+     * @param      result  The node result
+     *
+     * @return     True on success, false otherwise.
+     */
+    bool replayCsv(const std::string & path, const CsvLayout & layout,
+        NodeResult & result)
+    {
+        std::vector< char > data;
+        if (!readFile(path, data)) return false;
+        data.push_back('\0');
+
+        size_t columns = 1 + std::max(std::max(layout.timestamp, layout.lux),
+            std::max(layout.duty_cycle, layout.lux_reference));
+        std::vector< double > values(columns);
+        const char *p = data.data();
+        const char *end = p + data.size() - 1;
+        while (p < end)
+        {
+            // Parse the leading columns, then skip the rest of the line
+            size_t parsed = 0;
+            while (parsed < columns)
+            {
+                char *next;
+                values[parsed] = std::strtod(p, &next);
+                if (next == p) break;
+                parsed++;
+                p = next;
+                while (*p == ' ' || *p == '\t') p++;
+                if (*p != ',') break;
+                p++;
+            }
+            const char *eol = std::strchr(p, '\n');
+            p = (eol)? eol + 1 : end;
+            if (parsed < columns) continue;
+
+            result.metrics.update(
+                (unsigned long) values[layout.timestamp],
+                (float) values[layout.lux],
+                (float) values[layout.duty_cycle],
+                (float) values[layout.lux_reference]);
+            result.samples++;
+        }
+        return true;
+    }
+
+    /**
+     * @brief      Reads a column of a columnar export, as doubles.
+     *
+     * @param[in]  fd      The file descriptor
+     * @param[in]  header  The file header
+     * @param[in]  name    The column name
+     * @param      values  The values
+     *
+     * @return     True on success, false if missing or unreadable.
+     */
+    bool readColumn(int fd, const ColumnHeader & header, const char *name,
+        std::vector< double > & values)
+    {
+        for (size_t i = 0; i < std::min((size_t) header.columns, ColumnHeader::MAX_COLUMNS); i++)
+        {
+            const ColumnField & field = header.fields[i];
+            if (std::strncmp(field.name, name, sizeof(field.name)) != 0) continue;
+
+            size_t width = (field.type == JournalField::TYPE_F32)? sizeof(float) :
+                (field.type == JournalField::TYPE_U64 ||
+                    field.type == JournalField::TYPE_F64)? sizeof(uint64_t) : 0;
+            if (!width) return false;
+            std::vector< char > raw(header.rows * width);
+            if (pread(fd, raw.data(), raw.size(), field.offset) != (ssize_t) raw.size())
+            {
+                return false;
+            }
+            values.resize(header.rows);
+            for (size_t r = 0; r < header.rows; r++)
+            {
+                const char *v = raw.data() + r * width;
+                if (field.type == JournalField::TYPE_F32)
+                {
+                    float x;
+                    std::memcpy(&x, v, sizeof(x));
+                    values[r] = x;
+                }
+                else if (field.type == JournalField::TYPE_F64)
+                {
+                    std::memcpy(&values[r], v, sizeof(double));
+                }
+                else
+                {
+                    uint64_t x;
+                    std::memcpy(&x, v, sizeof(x));
+                    values[r] = (double) x;
+                }
+            }
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief      Replays a node's columnar export.
+     *
+     * @param[in]  path    The path
+     * @param      result  The node result
+     *
+     * @return     True on success, false otherwise.
+     */
+    bool replayColumns(const std::string & path, NodeResult & result)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd == -1) return false;
+
+        ColumnHeader header;
+        std::vector< double > timestamp, lux, duty_cycle, lux_reference;
+        bool ok = pread(fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header) &&
+            std::memcmp(header.magic, ColumnHeader::MAGIC, sizeof(header.magic)) == 0 &&
+            header.version == ColumnHeader::VERSION &&
+            readColumn(fd, header, "timestamp", timestamp) &&
+            readColumn(fd, header, "lux", lux) &&
+            readColumn(fd, header, "duty_cycle", duty_cycle) &&
+            readColumn(fd, header, "lux_reference", lux_reference);
+        ::close(fd);
+        if (!ok) return false;
+
+        for (size_t r = 0; r < timestamp.size(); r++)
+        {
+            result.metrics.update((unsigned long) timestamp[r], lux[r],
+                duty_cycle[r], lux_reference[r]);
+        }
+        result.samples = timestamp.size();
+        return true;
+    }
+
+    /**
+     * @brief      Replays the latest session of a journal.
+     *
+     * @param      run   The run
+     *
+     * @return     True on success, false otherwise.
+     */
+    bool replayJournal(Run & run)
+    {
+        JournalReader journal;
+        if (!journal.open(run.journal)) return false;
+        run.sample_period = journal.header().sample_period;
+
+        for (size_t i = ExportJob::sessionStart(journal, journal.size());
+            i < journal.size(); i++)
+        {
+            const JournalRecord & r = journal[i];
+            if (r.flags & JournalRecord::FLAG_RESET) continue;
+            if (r.id >= run.nodes.size()) run.nodes.resize(r.id + 1);
+            NodeResult & node = run.nodes[r.id];
+            node.metrics.update(r.timestamp, r.lux, r.duty_cycle, r.lux_reference);
+            node.samples++;
+        }
+        return true;
+    }
+
+    /**
+     * @brief      Finds the inputs of a run.
+     *
+     * @param      run   The run, named
+     *
+     * @return     True if any input was found, false otherwise.
+     */
+    bool findInputs(Run & run)
+    {
+        if (isFile(run.name))
+        {
+            run.journal = run.name;
+            return true;
+        }
+        std::string base = run.name + (isDirectory(run.name)? "/" : "_");
+        for (size_t id = 0; id < MAX_NODES; id++)
+        {
+            std::string path = base + std::to_string(id);
+            if (isFile(path + ".col")) path += ".col";
+            else if (isFile(path + ".csv")) path += ".csv";
+            else break;
+            run.files.push_back(path);
+        }
+        run.nodes.resize(run.files.size());
+        return !run.files.empty();
+    }
+
+    /**
+     * @brief      Parses a CSV layout, given as 1-based column numbers.
+     *
+     * @param[in]  arg     The argument, as time,lux,duty,reference
+     * @param      layout  The layout
+     *
+     * @return     True on success, false otherwise.
+     */
+    bool parseLayout(const std::string & arg, CsvLayout & layout)
+    {
+        size_t *fields[] = {&layout.timestamp, &layout.lux,
+            &layout.duty_cycle, &layout.lux_reference};
+        std::istringstream iss(arg);
+        std::string token;
+        for (size_t *field : fields)
+        {
+            if (!std::getline(iss, token, ',')) return false;
+            int column = std::atoi(token.c_str());
+            if (column < 1) return false;
+            *field = column - 1;
+        }
+        return true;
+    }
+
+    /**
+     * @brief      Class for a run's aggregate metrics.
+     */
+    class Totals
+    {
+
+    public:
+
+        /** Total energy */
+        double energy;
+        /** Total comfort error */
+        double comfort_error;
+        /** Total comfort variance */
+        double comfort_variance;
+        /** Number of samples */
+        size_t samples;
+
+        /**
+         * @brief      Sums the metrics of every node of a run.
+         *
+         * @param[in]  run   The run
+         */
+        explicit Totals(const Run & run)
+            : energy(0), comfort_error(0), comfort_variance(0), samples(0)
+        {
+            for (const NodeResult & node : run.nodes)
+            {
+                energy += node.metrics.energy();
+                comfort_error += node.metrics.comfortError();
+                comfort_variance += node.metrics.comfortVariance(run.sample_period);
+                samples += node.samples;
+            }
+        }
+    };
+
+    /**
+     * @brief      Formats a change relative to a baseline.
+     *
+     * @param[in]  value     The value
+     * @param[in]  baseline  The baseline
+     *
+     * @return     The change, in percent.
+     */
+    std::string change(double value, double baseline)
+    {
+        if (baseline == 0) return "-";
+        std::ostringstream oss;
+        oss << std::showpos << std::fixed << std::setprecision(1)
+            << 100 * (value - baseline) / baseline << "%";
+        return oss.str();
+    }
+
+    /**
+     * @brief      Prints a run's metrics, per node, in total and on average.
+     *
+     * @param[in]  run   The run
+     */
+    void printRun(const Run & run)
+    {
+        std::cout << run.name;
+        if (!run.ok)
+        {
+            std::cout << ": could not be read" << std::endl << std::endl;
+            return;
+        }
+        std::cout << std::endl << std::fixed
+            << std::setw(6) << "node" << std::setw(10) << "samples"
+            << std::setw(14) << "energy [J]" << std::setw(14) << "c_err [lx]"
+            << std::setw(18) << "c_var [lx/s^2]" << std::endl;
+        for (size_t i = 0; i < run.nodes.size(); i++)
+        {
+            const NodeResult & node = run.nodes[i];
+            std::cout << std::setw(6) << i << std::setw(10) << node.samples
+                << std::setprecision(3)
+                << std::setw(14) << node.metrics.energy()
+                << std::setw(14) << node.metrics.comfortError()
+                << std::setw(18) << node.metrics.comfortVariance(run.sample_period)
+                << std::endl;
+        }
+        Totals totals(run);
+        size_t n = std::max(run.nodes.size(), (size_t) 1);
+        std::cout << std::setw(6) << "T" << std::setw(10) << totals.samples
+            << std::setw(14) << totals.energy
+            << std::setw(14) << totals.comfort_error
+            << std::setw(18) << totals.comfort_variance << std::endl
+            << std::setw(6) << "avg" << std::setw(10) << totals.samples / n
+            << std::setw(14) << totals.energy / n
+            << std::setw(14) << totals.comfort_error / n
+            << std::setw(18) << totals.comfort_variance / n << std::endl
+            << std::endl;
+    }
+
+    /**
+     * @brief      Prints the totals of every run, relative to the first.
+     *
+     * @param[in]  runs  The runs
+     */
+    void printComparison(const std::vector< Run > & runs)
+    {
+        Totals baseline(runs[0]);
+        std::cout << "Totals relative to " << runs[0].name << std::endl
+            << std::setw(14) << "energy [J]" << std::setw(9) << ""
+            << std::setw(14) << "c_err [lx]" << std::setw(9) << ""
+            << std::setw(18) << "c_var [lx/s^2]" << std::setw(9) << ""
+            << "  run" << std::endl;
+        for (const Run & run : runs)
+        {
+            if (!run.ok) continue;
+            Totals totals(run);
+            std::cout << std::fixed << std::setprecision(3)
+                << std::setw(14) << totals.energy
+                << std::setw(9) << change(totals.energy, baseline.energy)
+                << std::setw(14) << totals.comfort_error
+                << std::setw(9) << change(totals.comfort_error, baseline.comfort_error)
+                << std::setw(18) << totals.comfort_variance
+                << std::setw(9) << change(totals.comfort_variance, baseline.comfort_variance)
+                << "  " << run.name << std::endl;
+        }
+    }
+}
+
+/**
+ * @brief      Analysis tool main application.
+ *
+ * @param[in]  argc  The argc
+ * @param      argv  The argv
+ *
+ * @return     0 on success, EXIT_FAILURE otherwise.
+ */
+int main(int argc, char *argv[])
+{
+    std::vector< Run > runs;
+    CsvLayout layout;
+    float sample_period = T_S;
+    size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "-j") == 0 && has_value)
+        {
+            threads = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (std::strcmp(argv[i], "-p") == 0 && has_value)
+        {
+            sample_period = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "-m") == 0 && has_value)
+        {
+            if (!parseLayout(argv[++i], layout))
+            {
+                std::cerr << "Invalid column layout " << argv[i] << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+        else
+        {
+            runs.push_back(Run());
+            runs.back().name = argv[i];
+        }
+    }
+    if (runs.empty())
+    {
+        std::cout << "Usage:\t" << argv[0] << " [-j threads] [-p period] [-m columns] <run>..." << std::endl;
+        std::cout << " e.g.:\t" << argv[0] << " -m 8,1,2,5 ../matlab/comparison/data/a ../matlab/comparison/data/b" << std::endl;
+        std::cout << "run:\ta journal, or node exports <run>/<id>.{col,csv} or <run>_<id>.{col,csv}" << std::endl;
+        std::cout << "-j:\tnumber of worker threads, by default one per core" << std::endl;
+        std::cout << "-p:\tsampling period of exported runs [s], by default " << T_S << std::endl;
+        std::cout << "-m:\tCSV columns of time [ms], lux, duty cycle and reference, by default 1,2,3,4" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Journals are replayed whole, exports one node at a time
+    std::vector< Task > tasks;
+    for (size_t r = 0; r < runs.size(); r++)
+    {
+        Run & run = runs[r];
+        run.sample_period = sample_period;
+        if (!findInputs(run))
+        {
+            run.ok = false;
+            continue;
+        }
+        if (!run.journal.empty()) tasks.push_back(Task{r, 0});
+        for (size_t n = 0; n < run.files.size(); n++) tasks.push_back(Task{r, n});
+    }
+
+    std::atomic< size_t > next(0);
+    std::vector< char > failed(tasks.size(), 0);
+    auto worker = [&]()
+    {
+        for (size_t t = next++; t < tasks.size(); t = next++)
+        {
+            Run & run = runs[tasks[t].run];
+            bool ok;
+            if (!run.journal.empty())
+            {
+                ok = replayJournal(run);
+            }
+            else
+            {
+                const std::string & path = run.files[tasks[t].node];
+                NodeResult & node = run.nodes[tasks[t].node];
+                ok = (path.compare(path.size() - 4, 4, ".col") == 0)?
+                    replayColumns(path, node) : replayCsv(path, layout, node);
+            }
+            failed[t] = !ok;
+        }
+    };
+    std::vector< std::thread > pool;
+    for (size_t i = 1; i < std::min(threads, tasks.size()); i++)
+    {
+        pool.push_back(std::thread(worker));
+    }
+    worker();
+    for (std::thread & t : pool) t.join();
+    for (size_t t = 0; t < tasks.size(); t++)
+    {
+        if (failed[t]) runs[tasks[t].run].ok = false;
+    }
+
+    for (const Run & run : runs) printRun(run);
+    if (runs.size() > 1) printComparison(runs);
+
+    bool ok = std::all_of(runs.begin(), runs.end(),
+        [](const Run & run) { return run.ok; });
+    return (ok)? 0 : EXIT_FAILURE;
+}
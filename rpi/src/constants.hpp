@@ -9,7 +9,7 @@
 #ifndef CONSTANTS_HPP
 #define CONSTANTS_HPP
 
-/** Number of nodes in system */
+/** Default number of nodes in system */
 #define NODES   2
 /** System sampling period (seconds) */
 #define T_S 0.1
@@ -18,19 +18,71 @@
 #define HOST "127.0.0.1"
 /** Listenning port for TCP server */
 #define PORT 17000
+/** Threads serving TCP sessions */
+#define TCP_THREADS 4
 
 /** Message delimiter */
 #define MSG_DELIMETER '\n'
 /** Message delimiter string */
 #define DELIMETER_STR "\n"
 
-/** Size of receive buffer */
+/** Size of receive buffer, the longest command accepted */
 #define RECV_BUFFER 1024
-/** Size of send buffer */
-#define SEND_BUFFER 1023
+/** Initial size of a session's response buffers */
+#define SEND_BUFFER 4096
 /** Size of packet */
 #define PACKET_SIZE 50
 
+/* History retention */
+
+/** Default maximum number of log entries kept per node (3 hours at T_S) */
+#define HISTORY_CAPACITY 108000
+/** Default maximum age of log entries (s), 0 keeps entries up to capacity */
+#define HISTORY_RETENTION 0
+/** Maximum number of compressed entries kept per node beyond capacity (1 day at T_S) */
+#define ARCHIVE_CAPACITY 864000
+
+/* Rollups */
+
+/** Number of 1 s rollup buckets kept per node (6 hours) */
+#define ROLLUP_1S_CAPACITY 21600
+/** Number of 10 s rollup buckets kept per node (1 day) */
+#define ROLLUP_10S_CAPACITY 8640
+/** Number of 1 min rollup buckets kept per node (1 week) */
+#define ROLLUP_1MIN_CAPACITY 10080
+
+/* Quantile sketches */
+
+/** Compression of per-node quantile sketches, roughly their maximum number of centroids */
+#define TDIGEST_COMPRESSION 100
+
+/* Journal */
+
+/** Default journal file path */
+#define JOURNAL_PATH "journal.bin"
+/** Journal growth and mapping step (bytes), a multiple of the page size */
+#define JOURNAL_CHUNK (1 << 20)
+/** Suffix of the journal of the previous session */
+#define JOURNAL_PREVIOUS ".prev"
+/** Period between journal syncs to disk (ms) */
+#define JOURNAL_SYNC_PERIOD 1000
+/** Size of the blocks written by exports (bytes) */
+#define EXPORT_BLOCK (1 << 20)
+
+/* Queries */
+
+/** Maximum number of time buckets in a query */
+#define QUERY_MAX_BUCKETS 1000
+
+/* Ingest */
+
+/** Capacity of the queue between I2C reception and commit (samples) */
+#define INGEST_QUEUE 1024
+/** Maximum number of samples committed per pass of the commit stage */
+#define COMMIT_BATCH 64
+/** Commit stage polling period when idle (ms) */
+#define COMMIT_PERIOD 2
+
 /** Serial communication Baudrate */
 #define SERIAL_BAUDRATE 115200
 
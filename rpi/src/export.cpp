@@ -0,0 +1,70 @@
+/**
+ * @file    rpi/src/export.cpp
+ *
+ * @brief   Journal export tool
+ *
+ * Converts a server journal into one file per node, with the columns
+ * timestamp, lux, duty cycle, lux reference, comfort error and comfort
+ * variance, as CSV or as typed columns, both read by the MATLAB analysis
+ * scripts. Comfort metrics are replayed from the journaled samples,
+ * restarting at each reset.
+ *
+ * @author  João Borrego
+ */
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+
+#include "JournalExport.hpp"
+
+/**
+ * @brief      Export tool main application.
+ *
+ * @param[in]  argc  The argc
+ * @param      argv  The argv
+ *
+ * @return     0 on success, EXIT_FAILURE otherwise.
+ */
+int main(int argc, char *argv[])
+{
+    std::vector< std::string > args;
+    bool all = false;
+    ExportJob::Format format = ExportJob::CSV;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "-a") == 0) all = true;
+        else if (std::strcmp(argv[i], "-c") == 0) format = ExportJob::COLUMNS;
+        else args.push_back(argv[i]);
+    }
+    if (args.empty() || args.size() > 2)
+    {
+        std::cout << "Usage:\t" << argv[0] << " <journal> [directory] [-a] [-c]" << std::endl;
+        std::cout << " e.g.:\t" << argv[0] << " journal.bin data" << std::endl;
+        std::cout << "-a:\texport every session, instead of the latest one since reset;"
+            << std::endl << "\ttimestamps are then relative to the first session" << std::endl;
+        std::cout << "-c:\twrite typed columns (<id>.col) instead of CSV (<id>.csv)" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::string directory = (args.size() > 1)? args[1] : ".";
+
+    JournalReader journal;
+    if (!journal.open(args[0]))
+    {
+        std::cerr << "Could not read journal " << args[0] << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Start after the latest reset, unless exporting every session
+    size_t first = (all)? 0 : ExportJob::sessionStart(journal, journal.size());
+    ExportJob job(args[0], directory, first, journal.size(), format);
+    if (!job.run())
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    std::cout << "Exported " << job.exported() << " of " << journal.size()
+        << " records to " << directory << std::endl;
+    return 0;
+}
@@ -0,0 +1,281 @@
+/**
+ * @file    rpi/src/kernels.hpp
+ *
+ * @brief   Column scan kernels
+ *
+ * Reductions over contiguous column data. Loops keep several independent
+ * lanes, so that the compiler may map them onto SIMD registers.
+ *
+ * @author  João Borrego
+ */
+
+#ifndef KERNELS_HPP
+#define KERNELS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+namespace Kernels
+{
+    /** Number of independent accumulator lanes */
+    const size_t LANES = 8;
+
+    /**
+     * @brief      Sums a quantised array.
+     *
+     * Integer accumulation is exact, so lanes need no reassociation care.
+     *
+     * @param[in]  x     The data
+     * @param[in]  n     The number of elements
+     *
+     * @return     The sum.
+     */
+    inline uint64_t sum(const uint16_t *x, size_t n)
+    {
+        uint64_t acc[LANES] = {0};
+        size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            for (size_t k = 0; k < LANES; k++) acc[k] += x[i + k];
+        }
+        uint64_t total = 0;
+        for (size_t k = 0; k < LANES; k++) total += acc[k];
+        for (; i < n; i++) total += x[i];
+        return total;
+    }
+
+    /**
+     * @brief      Obtains the minimum of a non-empty array.
+     *
+     * @param[in]  x     The data
+     * @param[in]  n     The number of elements
+     *
+     * @tparam     T     The element type
+     *
+     * @return     The minimum.
+     */
+    template < typename T >
+    inline T minimum(const T *x, size_t n)
+    {
+        T acc[LANES];
+        for (size_t k = 0; k < LANES; k++) acc[k] = x[0];
+        size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            for (size_t k = 0; k < LANES; k++)
+                acc[k] = (x[i + k] < acc[k])? x[i + k] : acc[k];
+        }
+        T result = acc[0];
+        for (size_t k = 1; k < LANES; k++) result = (acc[k] < result)? acc[k] : result;
+        for (; i < n; i++) result = (x[i] < result)? x[i] : result;
+        return result;
+    }
+
+    /**
+     * @brief      Obtains the maximum of a non-empty array.
+     *
+     * @param[in]  x     The data
+     * @param[in]  n     The number of elements
+     *
+     * @tparam     T     The element type
+     *
+     * @return     The maximum.
+     */
+    template < typename T >
+    inline T maximum(const T *x, size_t n)
+    {
+        T acc[LANES];
+        for (size_t k = 0; k < LANES; k++) acc[k] = x[0];
+        size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            for (size_t k = 0; k < LANES; k++)
+                acc[k] = (x[i + k] > acc[k])? x[i + k] : acc[k];
+        }
+        T result = acc[0];
+        for (size_t k = 1; k < LANES; k++) result = (acc[k] > result)? acc[k] : result;
+        for (; i < n; i++) result = (x[i] > result)? x[i] : result;
+        return result;
+    }
+
+    /**
+     * @brief      Counts timestamps strictly lower than a given value.
+     *
+     * Branchless, so the scan cost does not depend on the data.
+     *
+     * @param[in]  t      The timestamps
+     * @param[in]  n      The number of elements
+     * @param[in]  value  The value
+     *
+     * @tparam     T      The timestamp type
+     *
+     * @return     The count.
+     */
+    template < typename T >
+    inline size_t countLess(const T *t, size_t n, T value)
+    {
+        size_t acc[LANES] = {0};
+        size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            for (size_t k = 0; k < LANES; k++) acc[k] += (t[i + k] < value);
+        }
+        size_t total = 0;
+        for (size_t k = 0; k < LANES; k++) total += acc[k];
+        for (; i < n; i++) total += (t[i] < value);
+        return total;
+    }
+
+    /**
+     * @brief      Clears the mask of values outside an inclusive range.
+     *
+     * Branchless; a range with lo > hi clears the whole mask. The mask must
+     * not overlap the data, which lets byte stores vectorise.
+     *
+     * @param[in]  x     The data
+     * @param[in]  n     The number of elements
+     * @param[in]  lo    The lower bound
+     * @param[in]  hi    The upper bound
+     * @param      mask  The mask, 1 for selected elements and 0 otherwise
+     */
+    inline void selectRange(const uint16_t *__restrict x, size_t n, uint16_t lo,
+        uint16_t hi, uint8_t *__restrict mask)
+    {
+        // Unsigned wrap-around turns the range test into one comparison
+        uint16_t width = hi - lo;
+        uint8_t keep = (lo <= hi);
+        size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            for (size_t k = 0; k < LANES; k++)
+                mask[i + k] &= keep & ((uint16_t) (x[i + k] - lo) <= width);
+        }
+        for (; i < n; i++) mask[i] &= keep & ((uint16_t) (x[i] - lo) <= width);
+    }
+
+    /**
+     * @brief      Counts the selected elements.
+     *
+     * @param[in]  mask  The mask
+     * @param[in]  n     The number of elements
+     *
+     * @return     The count.
+     */
+    inline size_t countSelected(const uint8_t *mask, size_t n)
+    {
+        // 32-bit lanes vectorise better, and cannot overflow within a block
+        const size_t BLOCK = 1 << 16;
+        size_t total = 0;
+        size_t i = 0;
+        while (i + LANES <= n)
+        {
+            uint32_t acc[LANES] = {0};
+            size_t end = i + std::min(n - i, BLOCK) / LANES * LANES;
+            for (; i < end; i += LANES)
+            {
+                for (size_t k = 0; k < LANES; k++) acc[k] += mask[i + k];
+            }
+            for (size_t k = 0; k < LANES; k++) total += acc[k];
+        }
+        for (; i < n; i++) total += mask[i];
+        return total;
+    }
+
+    /**
+     * @brief      Sums the selected elements of a quantised array.
+     *
+     * @param[in]  x     The data
+     * @param[in]  mask  The mask
+     * @param[in]  n     The number of elements
+     *
+     * @return     The sum.
+     */
+    inline uint64_t maskedSum(const uint16_t *x, const uint8_t *mask, size_t n)
+    {
+        // 32-bit lanes vectorise better, and cannot overflow within a block
+        const size_t BLOCK = 1 << 16;
+        uint64_t total = 0;
+        size_t i = 0;
+        while (i + LANES <= n)
+        {
+            uint32_t acc[LANES] = {0};
+            size_t end = i + std::min(n - i, BLOCK) / LANES * LANES;
+            for (; i < end; i += LANES)
+            {
+                for (size_t k = 0; k < LANES; k++)
+                    acc[k] += x[i + k] & -(uint32_t) mask[i + k];
+            }
+            for (size_t k = 0; k < LANES; k++) total += acc[k];
+        }
+        for (; i < n; i++) total += x[i] & -(uint32_t) mask[i];
+        return total;
+    }
+
+    /**
+     * @brief      Obtains the minimum of the selected elements.
+     *
+     * @param[in]  x     The data
+     * @param[in]  mask  The mask
+     * @param[in]  n     The number of elements
+     *
+     * @return     The minimum, or UINT16_MAX if none is selected.
+     */
+    inline uint16_t maskedMinimum(const uint16_t *x, const uint8_t *mask, size_t n)
+    {
+        // Unselected elements are raised to the identity, UINT16_MAX
+        uint16_t acc[LANES];
+        for (size_t k = 0; k < LANES; k++) acc[k] = UINT16_MAX;
+        size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            for (size_t k = 0; k < LANES; k++)
+            {
+                uint16_t v = x[i + k] | (uint16_t) (mask[i + k] - 1);
+                acc[k] = (v < acc[k])? v : acc[k];
+            }
+        }
+        uint16_t result = UINT16_MAX;
+        for (size_t k = 0; k < LANES; k++) result = (acc[k] < result)? acc[k] : result;
+        for (; i < n; i++)
+        {
+            uint16_t v = x[i] | (uint16_t) (mask[i] - 1);
+            result = (v < result)? v : result;
+        }
+        return result;
+    }
+
+    /**
+     * @brief      Obtains the maximum of the selected elements.
+     *
+     * @param[in]  x     The data
+     * @param[in]  mask  The mask
+     * @param[in]  n     The number of elements
+     *
+     * @return     The maximum, or 0 if none is selected.
+     */
+    inline uint16_t maskedMaximum(const uint16_t *x, const uint8_t *mask, size_t n)
+    {
+        // Unselected elements are lowered to the identity, 0
+        uint16_t acc[LANES] = {0};
+        size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            for (size_t k = 0; k < LANES; k++)
+            {
+                uint16_t v = x[i + k] & (uint16_t) -mask[i + k];
+                acc[k] = (v > acc[k])? v : acc[k];
+            }
+        }
+        uint16_t result = 0;
+        for (size_t k = 0; k < LANES; k++) result = (acc[k] > result)? acc[k] : result;
+        for (; i < n; i++)
+        {
+            uint16_t v = x[i] & (uint16_t) -mask[i];
+            result = (v > result)? v : result;
+        }
+        return result;
+    }
+}
+
+#endif
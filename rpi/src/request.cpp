@@ -9,49 +9,378 @@
 
 #include "request.hpp"
 
+#include <cstdio>
+#include <cctype>
+
 void streamUpdate(
     System::ptr system,
     std::vector< unsigned long > & timestamps,
     const std::vector< bool> & flags,
+    ExportJob::ptr & job,
     std::string & response)
 {
     int nodes = system->getNodes();
     float var;
-    Entry *entry;
+    std::vector< NodeState > states;
+    Totals totals;
     response = "";
 
+    // Capture every node in a single pass
+    system->getSnapshot(states, totals);
+
     for (int i = 0; i < nodes; i++)
     {
-        entry = system->getLatestEntry((size_t) i);
-        if (entry != NULL){
-            if (entry->timestamp > timestamps[i]){
+        const Entry & entry = states[i].entry;
+        if (states[i].valid){
+            if (entry.timestamp > timestamps[i]){
                 if (flags[STREAM_FLAGS * i]){
-                    var = entry->lux;
+                    var = entry.lux;
                     if (var != -1){
                         response += "c " + std::string(1, LUX) + " "
                             + std::to_string(i) + " " + std::to_string(var)
-                            + " " + std::to_string(entry->timestamp) + " ";
+                            + " " + std::to_string(entry.timestamp) + " ";
                     }
                 }
                 if (flags[STREAM_FLAGS * i + 1]){
-                    var = entry->duty_cycle;
+                    var = entry.duty_cycle;
                     if (var != -1){
                         response += "c " + std::string(1, DUTY_CYCLE) + " "
                             + std::to_string(i) + " " + std::to_string(var)
-                            + " " + std::to_string(entry->timestamp) + " ";
+                            + " " + std::to_string(entry.timestamp) + " ";
                     }
                 }
-                timestamps[i] = entry->timestamp;
+                timestamps[i] = entry.timestamp;
             }
         }
     }
+
+    if (job)
+    {
+        ExportJob::State state = job->state();
+        if (state == ExportJob::DONE)
+        {
+            response += std::string(SAVE) + " done "
+                + std::to_string(job->exported()) + " ";
+            job.reset();
+        }
+        else if (state == ExportJob::FAILED)
+        {
+            response += std::string(SAVE) + " failed ";
+            job.reset();
+        }
+        else
+        {
+            response += std::string(SAVE) + " "
+                + std::to_string((int) (job->progress() * 100)) + " ";
+        }
+    }
     //debugPrintTrace(response);
 }
 
+/**
+ * @brief      Class for a get request parameter.
+ */
+class GetParameter
+{
+
+public:
+
+    /** Parameter character */
+    char param;
+    /** Whether the total over every node may be requested */
+    bool total;
+    /** Whether a window may be requested */
+    bool window;
+    /** Whether the value is formatted as an integer */
+    bool integer;
+    /** Gets the value, as get(system, id, total, window) */
+    double (*get)(System & system, int id, bool total, unsigned long window);
+};
+
+/** Get request parameters */
+static const GetParameter GET_PARAMETERS[] =
+{
+    {LUX,          false, false, false,
+        [](System & s, int id, bool, unsigned long) -> double { return s.getLux(id); }},
+    {DUTY_CYCLE,   false, false, false,
+        [](System & s, int id, bool, unsigned long) -> double { return s.getDutyCycle(id); }},
+    {OCCUPANCY,    false, false, true,
+        [](System & s, int id, bool, unsigned long) -> double { return s.getOccupancy(id); }},
+    {LUX_LOWER,    false, false, false,
+        [](System & s, int id, bool, unsigned long) -> double { return s.getLuxLowerBound(id); }},
+    {LUX_EXTERNAL, false, false, false,
+        [](System & s, int id, bool, unsigned long) -> double { return s.getLuxExternal(id); }},
+    {LUX_REF,      false, false, false,
+        [](System & s, int id, bool, unsigned long) -> double { return s.getLuxReference(id); }},
+    {POWER,        true,  false, false,
+        [](System & s, int id, bool t, unsigned long) -> double { return s.getPower(id, t); }},
+    {ENERGY,       true,  true,  false,
+        [](System & s, int id, bool t, unsigned long w) -> double { return s.getEnergy(id, t, w); }},
+    {COMFORT_ERR,  true,  true,  false,
+        [](System & s, int id, bool t, unsigned long w) -> double { return s.getComfortError(id, t, w); }},
+    {COMFORT_VAR,  true,  true,  false,
+        [](System & s, int id, bool t, unsigned long w) -> double { return s.getComfortVariance(id, t, w); }},
+    {TIMESTAMP,    false, false, false,
+        // Through a signed type, as no sample yet reads -1 ms
+        [](System & s, int id, bool, unsigned long) -> double {
+            return (float) (long) s.getTimestamp(id) / 1000.0; }},
+};
+
+/**
+ * @brief      Finds a get request parameter.
+ *
+ * @param[in]  param  The parameter character
+ *
+ * @return     The parameter, null if none.
+ */
+static const GetParameter *getParameter(char param)
+{
+    for (const GetParameter & p : GET_PARAMETERS)
+    {
+        if (p.param == param) return & p;
+    }
+    return nullptr;
+}
+
+/**
+ * @brief      Gets the current value of a variable.
+ *
+ * @param[in]  system  The system shared pointer
+ * @param[in]  param   The variable, as in a get request
+ * @param[in]  id      The node identifier, -1 for the total
+ * @param[in]  total   Whether the total over every node is requested
+ * @param[in]  window  The window (ms) of accumulated metrics, 0 since restart
+ * @param      value   The value; occupancy as 0 or 1, timestamps in seconds
+ *
+ * @return     True if the variable exists, false otherwise.
+ */
+static bool getValue(const System::ptr & system, char param, int id, bool total,
+    unsigned long window, double & value)
+{
+    const GetParameter *p = getParameter(param);
+    if (!p) return false;
+    value = p->get(*system, id, total, window);
+    return true;
+}
+
+/**
+ * @brief      Resets the system, and the streams of the requesting session.
+ *
+ * Shared by the text and binary protocols.
+ *
+ * @param[in]  system      The system shared pointer
+ * @param      timestamps  The session's stream timestamps
+ * @param      flags       The session's stream flags
+ */
+static void resetSession(const System::ptr & system,
+    std::vector< unsigned long > & timestamps, std::vector< bool > & flags)
+{
+    system->startWriteSerial(RESET);
+    system->reset();
+    for (size_t i = 0; i < system->getNodes(); i++){
+        timestamps.at(i) = 0;
+        for (int j = 0; j < STREAM_FLAGS; j++){
+            flags.at(i * STREAM_FLAGS + j) = false;
+        }
+    }
+}
+
+/**
+ * @brief      Parses the window of a get request, a plain positive decimal.
+ *
+ * @param[in]  token   The token, in seconds
+ * @param      window  The window (ms)
+ *
+ * @return     True if the token is a valid window, false otherwise.
+ */
+static bool parseWindow(boost::string_view token, unsigned long & window)
+{
+    char buffer[32];
+    if (token.empty() || token.size() >= sizeof(buffer)) return false;
+    for (char c : token)
+    {
+        if ((c < '0' || c > '9') && c != '.') return false;
+    }
+    memcpy(buffer, token.data(), token.size());
+    buffer[token.size()] = '\0';
+    char *end;
+    double window_s = strtod(buffer, & end);
+    if (*end != '\0' || !(window_s > 0)) return false;
+    window = (unsigned long) (window_s * 1000.0);
+    return true;
+}
+
+/**
+ * @brief      Maps a request variable to a history column.
+ *
+ * @param[in]  var     The variable (LUX | DUTY_CYCLE | LUX_REF | OCCUPANCY)
+ * @param      column  The column
+ *
+ * @return     True if the variable is stored, false otherwise.
+ */
+static bool queryColumn(const std::string & var, History::Column & column)
+{
+    if (var.size() != 1) return false;
+    switch (var[0])
+    {
+        case LUX:        column = History::COL_LUX;           return true;
+        case DUTY_CYCLE: column = History::COL_DUTY_CYCLE;    return true;
+        case LUX_REF:    column = History::COL_LUX_REFERENCE; return true;
+        case OCCUPANCY:  column = History::COL_OCCUPANCY;     return true;
+        default:         return false;
+    }
+}
+
+/**
+ * @brief      Parses a query filter.
+ *
+ * Either o (occupied), !o (vacant) or a comparison such as l < 30.
+ *
+ * @param      iss        The request stream, after the filter keyword
+ * @param      query      The query
+ *
+ * @return     True on success, false otherwise.
+ */
+static bool queryCondition(std::istream & iss, Query & query)
+{
+    std::string var, op;
+    float value;
+    History::Column column;
+    if (!(iss >> var)) return false;
+    if (var == std::string(1, OCCUPANCY) || var == QUERY_VACANT)
+    {
+        query.conditions.push_back(Query::compare(History::COL_OCCUPANCY,
+            Query::OP_EQUAL, (var == QUERY_VACANT)? 0 : 1));
+        return true;
+    }
+    if (!queryColumn(var, column) || !(iss >> op >> value)) return false;
+
+    Query::Operator oper;
+    if (op == "<")       oper = Query::OP_LESS;
+    else if (op == "<=") oper = Query::OP_LESS_EQUAL;
+    else if (op == ">")  oper = Query::OP_GREATER;
+    else if (op == ">=") oper = Query::OP_GREATER_EQUAL;
+    else if (op == "=")  oper = Query::OP_EQUAL;
+    else return false;
+    query.conditions.push_back(Query::compare(column, oper, value));
+    return true;
+}
+
+/**
+ * @brief      Parses and runs a query, of the form
+ *             Q (agg) (x) (nodes) [last (s) | from (s) to (s)] [by (s)]
+ *             [where (filter) [and (filter)]...]
+ *
+ * @param[in]  system    The system shared pointer
+ * @param[in]  agg       The aggregate function
+ * @param[in]  var       The variable
+ * @param[in]  nodes     The nodes, comma-separated, or T for every node
+ * @param      iss       The request stream, after the nodes
+ * @param      response  The response string
+ */
+static void runQuery(
+    System::ptr system,
+    const std::string & agg,
+    const std::string & var,
+    const std::string & nodes,
+    std::istream & iss,
+    std::string & response)
+{
+    Query query;
+    response = INVALID;
+
+    if (agg == "avg")        query.aggregate = Query::AGG_AVG;
+    else if (agg == "min")   query.aggregate = Query::AGG_MIN;
+    else if (agg == "max")   query.aggregate = Query::AGG_MAX;
+    else if (agg == "sum")   query.aggregate = Query::AGG_SUM;
+    else if (agg == "count") query.aggregate = Query::AGG_COUNT;
+    else return;
+    if (!queryColumn(var, query.column)) return;
+
+    if (nodes.size() == 1 && nodes[0] == TOTAL)
+    {
+        for (size_t i = 0; i < system->getNodes(); i++) query.nodes.push_back(i);
+    }
+    else
+    {
+        std::istringstream list(nodes);
+        std::string token;
+        while (std::getline(list, token, ','))
+        {
+            try
+            {
+                int id = std::stoi(token);
+                if (id < 0 || (size_t) id >= system->getNodes()) return;
+                query.nodes.push_back(id);
+            }
+            catch (std::exception & e)
+            {
+                return;
+            }
+        }
+        if (query.nodes.empty()) return;
+    }
+
+    // Last minute by default
+    unsigned long now = system->millis();
+    query.end = now;
+    query.start = (now > 60 * 1000)? now - 60 * 1000 : 0;
+
+    std::string clause;
+    bool filtering = false;
+    while (iss >> clause)
+    {
+        double seconds;
+        if (clause == QUERY_WHERE || (clause == QUERY_AND && filtering))
+        {
+            filtering = true;
+            if (!queryCondition(iss, query)) return;
+            continue;
+        }
+        if (!(iss >> seconds) || seconds < 0) return;
+        unsigned long ms = (unsigned long) (seconds * 1000.0);
+        if (clause == QUERY_LAST)
+        {
+            query.start = (now > ms)? now - ms : 0;
+            query.end = now;
+        }
+        else if (clause == QUERY_FROM) query.start = ms;
+        else if (clause == QUERY_TO)   query.end = ms;
+        else if (clause == QUERY_BY && ms > 0) query.bucket = ms;
+        else return;
+    }
+    if (query.end < query.start || query.buckets() > QUERY_MAX_BUCKETS) return;
+
+    std::vector< QueryBucket > buckets;
+    if (!system->query(query, buckets)) return;
+
+    // Buckets without selected entries are left out
+    std::stringstream stream;
+    stream << std::fixed << std::setprecision(2);
+    for (size_t i = 0; i < buckets.size(); i++)
+    {
+        double value = query.value(buckets[i]);
+        if (std::isnan(value)) continue;
+        int precision = (query.aggregate == Query::AGG_COUNT)? 0 :
+            (query.column == History::COL_DUTY_CYCLE)? 4 : 2;
+        stream << query.bucketStart(i) / 1000.0 << " "
+            << std::setprecision(precision) << value
+            << std::setprecision(2) << ", ";
+    }
+    response = std::string(QUERY) + " " + agg + " " + var + " " + nodes;
+    std::string values = stream.str();
+    if (!values.empty())
+    {
+        values.erase(values.size() - 2);
+        response += " " + values;
+    }
+}
+
 void parseRequest(
     System::ptr system,
     std::vector< unsigned long > & timestamps,
     std::vector< bool> & flags,
+    ExportJob::ptr & job,
     const std::string & request,
     std::string & response)
 {
@@ -84,14 +413,7 @@ void parseRequest(
     {
         if (type == RESET)
         {
-            system->startWriteSerial(RESET);
-            system->reset();
-            for (int i = 0; i < system->getNodes(); i++){
-                timestamps.at(i) = 0;
-                for (int j = 0; j < STREAM_FLAGS; j++){
-                    flags.at(i * STREAM_FLAGS + j) = false; 
-                }
-            }
+            resetSession(system, timestamps, flags);
             response = ACK;
         }
         else if (type == DISTRIBUTED_ON)
@@ -102,9 +424,32 @@ void parseRequest(
         {
             system->startWriteSerial(DISTRIBUTED_OFF);
         }
+        else if (type == QUERY)
+        {
+            std::string nodes;
+            iss >> nodes;
+            runQuery(system, cmd, arg, nodes, iss, response);
+        }
         else if (type == SAVE)
         {
-            system->saveEntries();
+            // One export per session at a time, reported by its stream
+            ExportJob::Format format = ExportJob::CSV;
+            if (cmd == SAVE_COLUMNS)
+            {
+                format = ExportJob::COLUMNS;
+            }
+            else if (!cmd.empty() && cmd != SAVE_CSV)
+            {
+                response = INVALID;
+                return;
+            }
+            if (job)
+            {
+                response = INVALID;
+                return;
+            }
+            job = system->saveEntries(format);
+            response = (job)? ACK : INVALID;
         }
         else
         {
@@ -132,104 +477,118 @@ void parseRequest(
                         try
                         {
                             id = std::stoi(arg);
-                            if (id < 0 || id >= system->getNodes()) throw std::exception();
+                            if (id < 0 || (size_t) id >= system->getNodes()) throw std::exception();
                         }
-                        catch (std::exception e)
+                        catch (std::exception & e)
                         {
                             response = INVALID;
                             return;
                         }
                     }
 
-                    // Prevent cross initialisation errors in switch
-                    float value_f = -1;
-                    int value_i = -1;
-                    bool value_b = 0;
-                    long value_l = -1;
-
-                    std::string id_str(std::to_string(id));
-
-                    switch (param)
+                    // Optional window, in seconds up to now, for the
+                    // accumulated metrics
+                    unsigned long window = 0;
+                    std::string window_arg;
+                    if (iss >> window_arg)
                     {
-                        case LUX:
-                            value_f = system->getLux(id);
-                            response = std::string(1,LUX) + " " + id_str
-                                + " " + std::to_string(value_f);
-                            break;
-                        case DUTY_CYCLE:
-                            value_f = system->getDutyCycle(id);
-                            response = std::string(1, DUTY_CYCLE) + " " + id_str
-                                + " " + std::to_string(value_f);
-                            break;
-                        case OCCUPANCY:
-                            value_b = system->getOccupancy(id);
-                            response = std::string(1, OCCUPANCY) + " " + id_str
-                                + " " + std::to_string(value_b);
-                            break;
-                        case LUX_LOWER:
-                            value_f = system->getLuxLowerBound(id);
-                            response = std::string(1, LUX_LOWER) + " " + id_str
-                                + " " + std::to_string(value_f);
-                            break;
-                        case LUX_EXTERNAL:
-                            value_f = system->getLuxExternal(id);
-                            response = std::string(1, LUX_EXTERNAL) + " " + id_str
-                                + " " + std::to_string(value_f);
-                            break;
-                        case LUX_REF:
-                            value_f = system->getLuxReference(id);
-                            response =  std::string(1, LUX_REF) + " " + id_str
-                                + " " + std::to_string(value_f);
-                            break;
-                        case POWER:
-                            value_f = system->getPower(id, total);
-                            response =  std::string(1, POWER) + " " +
-                                ((id == -1 && total)? std::string(1, TOTAL) : id_str)
-                                + " " + std::to_string(value_f);
-                            break;
-                        case ENERGY:
-                            value_f = system->getEnergy(id, total);
-                            response =  std::string(1, ENERGY) + " " +
-                                ((id == -1 && total)? std::string(1, TOTAL) : id_str)
-                                + " " + std::to_string(value_f);
-                            break;
-                        case COMFORT_ERR:
-                            value_f = system->getComfortError(id, total);
-                            response =  std::string(1, COMFORT_ERR) + " " +
-                                ((id == -1 && total)? std::string(1, TOTAL) : id_str)
-                                + " " + std::to_string(value_f);
-                            break;
-                        case COMFORT_VAR:
-                            value_f = system->getComfortVariance(id, total);
-                            response =  std::string(1, COMFORT_VAR) + " " +
-                                ((id == -1 && total)? std::string(1, TOTAL) : id_str)
-                                + " " + std::to_string(value_f);
-                            break;
-                        case TIMESTAMP:
-                            value_l  = system->getTimestamp(id);
-                            response =  std::string(1, TIMESTAMP) + " " + id_str
-                                + " " + std::to_string((float) value_l / 1000.0);
-                            break;
-                        default:
+                        if (!parseWindow(window_arg, window) || !(param == ENERGY ||
+                            param == COMFORT_ERR || param == COMFORT_VAR))
+                        {
                             response = INVALID;
+                            return;
+                        }
                     }
+
+                    double value;
+                    if (!getValue(system, param, id, total, window, value))
+                    {
+                        response = INVALID;
+                        return;
+                    }
+                    response = std::string(1, param) + " "
+                        + ((total)? std::string(1, TOTAL) : std::to_string(id)) + " "
+                        + ((param == OCCUPANCY)? std::to_string((int) value)
+                            : std::to_string(value));
                 }
                 else if (type == SET)
                 {
                     try
                     {
                         int id = std::stoi(cmd);
-                        if (id < 0 || id >= system->getNodes()) throw std::exception();
-                        bool val = std::stoi(arg);
-                        std::string serial_msg("");
+                        if (id < 0 || (size_t) id >= system->getNodes()) throw std::exception();
+                        // Validates the value, forwarded as requested
+                        std::stoi(arg);
                         system->startWriteSerial(request);
                         response = ACK;
                     }
-                    catch (std::exception e)
+                    catch (std::exception & e)
                     {
                         response = INVALID;
                     }
                 }
+                else if (type == QUANTILES)
+                {
+                    // Tracking error (c) or duty cycle (d), followed by
+                    // optional percentiles, by default the median and tails
+                    char var = cmd[0];
+                    if (var != COMFORT_ERR && var != DUTY_CYCLE)
+                    {
+                        response = INVALID;
+                        return;
+                    }
+                    if (arg.size() == 1 && arg[0] == TOTAL)
+                    {
+                        total = true;
+                    }
+                    else
+                    {
+                        try
+                        {
+                            id = std::stoi(arg);
+                            if (id < 0 || (size_t) id >= system->getNodes()) throw std::exception();
+                        }
+                        catch (std::exception & e)
+                        {
+                            response = INVALID;
+                            return;
+                        }
+                    }
+
+                    std::vector< double > quantiles;
+                    double percentile;
+                    while (iss >> percentile)
+                    {
+                        if (percentile < 0 || percentile > 100)
+                        {
+                            response = INVALID;
+                            return;
+                        }
+                        quantiles.push_back(percentile / 100.0);
+                    }
+                    if (!iss.eof())
+                    {
+                        response = INVALID;
+                        return;
+                    }
+                    if (quantiles.empty())
+                    {
+                        quantiles = {0.50, 0.95, 0.99};
+                    }
+
+                    std::vector< double > values;
+                    if (!system->getQuantiles(id, total, var, quantiles, values))
+                    {
+                        response = INVALID;
+                        return;
+                    }
+                    response = std::string(QUANTILES) + " " + std::string(1, var)
+                        + " " + ((total)? std::string(1, TOTAL) : std::to_string(id));
+                    for (double value : values)
+                    {
+                        response += " " + std::to_string(value);
+                    }
+                }
                 else if (type == START_STREAM || type == STOP_STREAM || type == LAST_MINUTE)
                 {
                     if (cmd.size() == 1)
@@ -238,9 +597,9 @@ void parseRequest(
                         try
                         {
                             id = std::stoi(arg);
-                            if (id < 0 || id >= system->getNodes()) throw std::exception();
+                            if (id < 0 || (size_t) id >= system->getNodes()) throw std::exception();
                         }
-                        catch (std::exception e)
+                        catch (std::exception & e)
                         {
                             response = INVALID;
                             return;
@@ -248,7 +607,32 @@ void parseRequest(
 
                         if (type == LAST_MINUTE)
                         {
-                            system->getValuesInPeriod(id, minute_ago, now, var, response);
+                            // Optional explicit period, in seconds since reset,
+                            // and resolution in seconds
+                            unsigned long start = minute_ago, end = now;
+                            unsigned long resolution = 0;
+                            double start_s, end_s, resolution_s;
+                            if (iss >> start_s)
+                            {
+                                if (!(iss >> end_s) || start_s < 0 || end_s < start_s)
+                                {
+                                    response = INVALID;
+                                    return;
+                                }
+                                start = (unsigned long) (start_s * 1000.0);
+                                end = (unsigned long) (end_s * 1000.0);
+                                if (iss >> resolution_s)
+                                {
+                                    if (resolution_s < 0)
+                                    {
+                                        response = INVALID;
+                                        return;
+                                    }
+                                    resolution = (unsigned long) (resolution_s * 1000.0);
+                                }
+                            }
+                            system->getValuesInPeriod(id, start, end, var,
+                                response, resolution);
                         }
                         else
                         {
@@ -282,3 +666,348 @@ void parseRequest(
         response = INVALID;
     }
 }
+
+/** Maximum number of tokens of a request handled by dispatchRequest() */
+static const size_t MAX_TOKENS = 4;
+
+/**
+ * @brief      Splits a request into whitespace-separated tokens.
+ *
+ * @param[in]  request  The request
+ * @param      tokens   The tokens, of size MAX_TOKENS
+ *
+ * @return     The number of tokens, above MAX_TOKENS if there are more.
+ */
+static size_t tokenise(boost::string_view request, boost::string_view *tokens)
+{
+    size_t n = 0;
+    size_t i = 0;
+    while (true)
+    {
+        while (i < request.size() && std::isspace((unsigned char) request[i])) i++;
+        if (i == request.size()) return n;
+        size_t start = i;
+        while (i < request.size() && !std::isspace((unsigned char) request[i])) i++;
+        if (n == MAX_TOKENS) return n + 1;
+        tokens[n++] = request.substr(start, i - start);
+    }
+}
+
+/**
+ * @brief      Parses a plain decimal node identifier.
+ *
+ * @param[in]  token   The token
+ * @param[in]  nodes   The number of nodes
+ * @param      id      The node identifier
+ *
+ * @return     True if the token is a valid node, false otherwise.
+ */
+static bool parseNode(boost::string_view token, int nodes, int & id)
+{
+    if (token.empty() || token.size() > 9) return false;
+    id = 0;
+    for (char c : token)
+    {
+        if (c < '0' || c > '9') return false;
+        id = id * 10 + (c - '0');
+    }
+    return id < nodes;
+}
+
+/**
+ * @brief      Appends an unsigned integer in decimal.
+ *
+ * @param      out    The output
+ * @param[in]  value  The value
+ */
+static void appendUnsigned(std::string & out, unsigned long long value)
+{
+    char digits[20];
+    size_t n = 0;
+    do
+    {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (n) out += digits[--n];
+}
+
+/**
+ * @brief      Appends a value as std::to_string() does, with six decimals.
+ *
+ * Values held by a float are formatted without printf: their fraction in
+ * millionths is exact in double precision, so ties are rounded to even as
+ * printf does.
+ *
+ * @param      out    The output
+ * @param[in]  value  The value
+ */
+static void appendFixed(std::string & out, double value)
+{
+    double magnitude = std::fabs(value);
+    if (!(magnitude < 1e9) || (double) (float) value != value)
+    {
+        char buffer[400];
+        int n = snprintf(buffer, sizeof(buffer), "%f", value);
+        out.append(buffer, n);
+        return;
+    }
+    double integer = std::floor(magnitude);
+    double millionths = (magnitude - integer) * 1e6;
+    double rounded = std::floor(millionths);
+    unsigned long long fraction = (unsigned long long) rounded;
+    double rest = millionths - rounded;
+    if (rest > 0.5 || (rest == 0.5 && (fraction & 1))) fraction++;
+    unsigned long long whole = (unsigned long long) integer;
+    if (fraction == 1000000)
+    {
+        fraction = 0;
+        whole++;
+    }
+
+    if (std::signbit(value)) out += '-';
+    appendUnsigned(out, whole);
+    out += '.';
+    char digits[6];
+    for (int i = 5; i >= 0; i--)
+    {
+        digits[i] = '0' + fraction % 10;
+        fraction /= 10;
+    }
+    out.append(digits, sizeof(digits));
+}
+
+/**
+ * @brief      Performs a get request, g (x) (i) [w].
+ *
+ * @return     True if handled, false to fall back to parseRequest().
+ */
+static bool dispatchGet(const System::ptr & system, const boost::string_view *tokens,
+    size_t n, std::string & response)
+{
+    if (n < 3 || tokens[1].size() != 1) return false;
+    const GetParameter *p = getParameter(tokens[1][0]);
+    if (!p) return false;
+
+    int id = -1;
+    bool total = (tokens[2].size() == 1 && tokens[2][0] == TOTAL);
+    if (total && !p->total) return false;
+    if (!total && !parseNode(tokens[2], system->getNodes(), id)) return false;
+
+    // A window that is malformed, or of a metric without one, is invalid
+    // on either path, so it is answered here
+    unsigned long window = 0;
+    if (n == 4 && (!p->window || !parseWindow(tokens[3], window)))
+    {
+        response += INVALID;
+        return true;
+    }
+
+    double value = p->get(*system, id, total, window);
+    response += p->param;
+    response += ' ';
+    if (total) response += TOTAL;
+    else appendUnsigned(response, id);
+    response += ' ';
+    if (p->integer) appendUnsigned(response, (unsigned long long) value);
+    else appendFixed(response, value);
+    return true;
+}
+
+/**
+ * @brief      Performs a set request, s (i) (val).
+ *
+ * @return     True if handled, false to fall back to parseRequest().
+ */
+static bool dispatchSet(const System::ptr & system, boost::string_view request,
+    const boost::string_view *tokens, size_t n, std::string & response)
+{
+    int id, value;
+    if (n != 3 || !parseNode(tokens[1], system->getNodes(), id) ||
+        !parseNode(tokens[2], 2, value))
+    {
+        return false;
+    }
+    system->startWriteSerial(std::string(request.data(), request.size()));
+    response += ACK;
+    return true;
+}
+
+/**
+ * @brief      Starts or stops a stream, c (x) (i) or d (x) (i).
+ *
+ * @return     True if handled, false to fall back to parseRequest().
+ */
+static bool dispatchStream(const System::ptr & system, std::vector< bool > & flags,
+    const boost::string_view *tokens, size_t n)
+{
+    int id;
+    if (n != 3 || tokens[1].size() != 1 ||
+        !parseNode(tokens[2], system->getNodes(), id))
+    {
+        return false;
+    }
+    size_t flag;
+    switch (tokens[1][0])
+    {
+        case LUX:        flag = 0; break;
+        case DUTY_CYCLE: flag = 1; break;
+        default:         return false;
+    }
+    flags[id * STREAM_FLAGS + flag] = (tokens[0][0] == START_STREAM[0]);
+    return true;
+}
+
+void dispatchRequest(
+    const System::ptr & system,
+    std::vector< unsigned long > & timestamps,
+    std::vector< bool > & flags,
+    ExportJob::ptr & job,
+    boost::string_view request,
+    std::string & response)
+{
+    // Common requests in their plain form are handled in place, any other
+    // (or malformed) request by the general parser
+    boost::string_view tokens[MAX_TOKENS];
+    size_t n = tokenise(request, tokens);
+    if (n >= 1 && n <= MAX_TOKENS && tokens[0].size() == 1)
+    {
+        size_t size = response.size();
+        bool handled = false;
+        switch (tokens[0][0])
+        {
+            case GET[0]:
+                handled = dispatchGet(system, tokens, n, response);
+                break;
+            case SET[0]:
+                handled = dispatchSet(system, request, tokens, n, response);
+                break;
+            case START_STREAM[0]:
+            case STOP_STREAM[0]:
+                handled = dispatchStream(system, flags, tokens, n);
+                break;
+        }
+        if (handled) return;
+        response.resize(size);
+    }
+
+    std::string fallback;
+    parseRequest(system, timestamps, flags, job,
+        std::string(request.data(), request.size()), fallback);
+    response += fallback;
+}
+
+/**
+ * @brief      Appends a binary response frame.
+ *
+ * @param      response  The response frames
+ * @param[in]  opcode    The opcode
+ * @param[in]  node      The node id
+ * @param[in]  value     The value, if any
+ * @param[in]  valued    Whether the frame carries the value
+ */
+static void binaryFrame(std::string & response, uint8_t opcode, uint16_t node,
+    float value = 0, bool valued = false)
+{
+    uint16_t length = BINARY_HEADER_SIZE + ((valued)? sizeof(float) : 0);
+    response += (char) (length & 0xFF);
+    response += (char) (length >> 8);
+    response += (char) opcode;
+    response += (char) (node & 0xFF);
+    response += (char) (node >> 8);
+    if (valued)
+    {
+        uint32_t bits;
+        memcpy(& bits, & value, sizeof(bits));
+        for (size_t i = 0; i < sizeof(bits); i++)
+        {
+            response += (char) ((bits >> (8 * i)) & 0xFF);
+        }
+    }
+}
+
+void parseBinaryRequest(
+    const System::ptr & system,
+    std::vector< unsigned long > & timestamps,
+    std::vector< bool > & flags,
+    const uint8_t *request,
+    size_t length,
+    std::string & response)
+{
+    if (length < BINARY_HEADER_SIZE)
+    {
+        binaryFrame(response, BINARY_INVALID, BINARY_TOTAL);
+        return;
+    }
+    uint8_t opcode = request[0];
+    uint16_t node = request[1] | (request[2] << 8);
+    const uint8_t *payload = request + BINARY_HEADER_SIZE;
+    size_t payload_size = length - BINARY_HEADER_SIZE;
+
+    bool total = (node == BINARY_TOTAL);
+    int id = (total)? -1 : node;
+    if (!total && (size_t) id >= system->getNodes())
+    {
+        binaryFrame(response, BINARY_INVALID, node);
+        return;
+    }
+
+    if (opcode == BINARY_RESET)
+    {
+        resetSession(system, timestamps, flags);
+        binaryFrame(response, opcode, node);
+        return;
+    }
+    if (opcode == BINARY_SET_OCCUPANCY)
+    {
+        if (total || payload_size != 1 || payload[0] > 1)
+        {
+            binaryFrame(response, BINARY_INVALID, node);
+            return;
+        }
+        // The controllers are sent the equivalent text request
+        system->startWriteSerial(std::string(SET) + " " + std::to_string(id)
+            + " " + std::to_string(payload[0]));
+        binaryFrame(response, opcode, node);
+        return;
+    }
+
+    // Get requests, with the same totals and windows as their text forms
+    bool accumulated = (opcode == ENERGY || opcode == COMFORT_ERR ||
+        opcode == COMFORT_VAR);
+    unsigned long window = 0;
+    if (total && !accumulated && opcode != POWER)
+    {
+        binaryFrame(response, BINARY_INVALID, node);
+        return;
+    }
+    if (payload_size == sizeof(float) && accumulated)
+    {
+        uint32_t bits = 0;
+        float window_s;
+        for (size_t i = 0; i < sizeof(bits); i++)
+        {
+            bits |= (uint32_t) payload[i] << (8 * i);
+        }
+        memcpy(& window_s, & bits, sizeof(window_s));
+        if (!(window_s > 0))
+        {
+            binaryFrame(response, BINARY_INVALID, node);
+            return;
+        }
+        window = (unsigned long) (window_s * 1000.0);
+    }
+    else if (payload_size != 0)
+    {
+        binaryFrame(response, BINARY_INVALID, node);
+        return;
+    }
+
+    double value;
+    if (!getValue(system, opcode, id, total, window, value))
+    {
+        binaryFrame(response, BINARY_INVALID, node);
+        return;
+    }
+    binaryFrame(response, opcode, node, value, true);
+}
@@ -12,7 +12,10 @@
 
 #include <iostream>
 #include <sstream>
+#include <cstdint>
+#include <boost/utility/string_view.hpp>
 #include <ctime>
+#include <cmath>
 
 #include "debug.hpp"
 #include "constants.hpp"
@@ -26,21 +29,49 @@
 #define SET             "s"
 /** Request to reset the system */
 #define RESET           "r"
-/** Get buffer with last minute information on a given variable */
+/** Get buffer with last minute (or given period and resolution) information on a given variable */
 #define LAST_MINUTE     "b"
 /** Start "real-time" stream of given variable */
 #define START_STREAM    "c"
 /** Stop "real-time" stream of given variable */
 #define STOP_STREAM     "d"
+/** Get quantiles of tracking error or duty cycle at desk or total */
+#define QUANTILES       "q"
+/** Filter and aggregate stored entries of a set of desks */
+#define QUERY           "Q"
 
 /** Activate distributed control */
 #define DISTRIBUTED_ON  "A"
 /** Deactivate distributed control */
 #define DISTRIBUTED_OFF "D"
 
-/** Dump stored entries to file */
+/** Export the current session to file, in the background */
 #define SAVE            "S"
 
+/* Save formats */
+
+/** Export to CSV files (default) */
+#define SAVE_CSV        "csv"
+/** Export to typed columnar files */
+#define SAVE_COLUMNS    "col"
+
+/* Query clauses */
+
+/** Period up to now, in seconds */
+#define QUERY_LAST      "last"
+/** Period start, in seconds since restart */
+#define QUERY_FROM      "from"
+/** Period end, in seconds since restart */
+#define QUERY_TO        "to"
+/** Bucket length, in seconds */
+#define QUERY_BY        "by"
+/** First filter */
+#define QUERY_WHERE     "where"
+/** Further filters */
+#define QUERY_AND       "and"
+/** Unoccupied desk filter */
+#define QUERY_VACANT    "!o"
+
 /* Get requests */
 
 /** Get current measured illuminance at desk */
@@ -76,6 +107,23 @@
 /** Invalid request */
 #define INVALID         "Invalid request!"
 
+/* Binary protocol */
+
+/** First byte of a session selecting the binary protocol, echoed on accept */
+#define BINARY_HANDSHAKE        0x01
+/** Size of a frame's little-endian length, counting the bytes that follow */
+#define BINARY_LENGTH_SIZE      2
+/** Size of a frame's opcode and little-endian 16-bit node id */
+#define BINARY_HEADER_SIZE      3
+/** Node id standing for every node, above any node the journal can record */
+#define BINARY_TOTAL            0xFFFF
+/** Set occupancy state at desk, to a one byte value */
+#define BINARY_SET_OCCUPANCY    0x80
+/** Reset the system */
+#define BINARY_RESET            0x81
+/** Response to an invalid request */
+#define BINARY_INVALID          0xFF
+
 /* Functions */
 
 /**
@@ -84,6 +132,7 @@
  * @param[in]  system      The system shared pointer
  * @param      timestamps  The timestamps vector
  * @param      flags       The flags vector
+ * @param      job         The session export
  * @param[in]  request     The request string
  * @param      response    The response string
  */
@@ -91,21 +140,73 @@ void parseRequest(
     System::ptr system,
     std::vector< unsigned long > & timestamps,
     std::vector< bool> & flags,
+    ExportJob::ptr & job,
     const std::string & request,
     std::string & response);
 
+/**
+ * @brief      Performs a request and appends its response, without allocating
+ *             for common requests.
+ *
+ * Get, set and stream requests in their plain form are parsed in place and
+ * answered into the response buffer. Any other request is handled by
+ * parseRequest(), with the same response.
+ *
+ * @param[in]  system      The system shared pointer
+ * @param      timestamps  The timestamps vector
+ * @param      flags       The flags vector
+ * @param      job         The session export
+ * @param[in]  request     The request, without its delimiter
+ * @param      response    The response buffer, appended to
+ */
+void dispatchRequest(
+    const System::ptr & system,
+    std::vector< unsigned long > & timestamps,
+    std::vector< bool > & flags,
+    ExportJob::ptr & job,
+    boost::string_view request,
+    std::string & response);
+
 /**
  * @brief      Produces a stream update string.
  *
+ * Also reports the progress of the session export, if any, and its outcome
+ * once finished.
+ *
  * @param[in]  system      The system shared pointer
  * @param      timestamps  The timestamps vector
  * @param[in]  flags       The flags vector
+ * @param      job         The session export
  * @param      response    The response string
  */
 void streamUpdate(
     System::ptr system,
     std::vector< unsigned long > & timestamps,
     const std::vector< bool> & flags,
+    ExportJob::ptr & job,
+    std::string & response);
+
+/**
+ * @brief      Performs a binary request and appends its response frame.
+ *
+ * Get requests use the parameter characters as opcodes and, for accumulated
+ * metrics, an optional little-endian float window [s] as payload. Responses
+ * echo the opcode and node id, followed by the value as a little-endian
+ * float, if any.
+ *
+ * @param[in]  system      The system shared pointer
+ * @param      timestamps  The session's stream timestamps, cleared on reset
+ * @param      flags       The session's stream flags, cleared on reset
+ * @param[in]  request     The request frame, past its length
+ * @param[in]  length      The request frame length
+ * @param      response    The response frames
+ */
+void parseBinaryRequest(
+    const System::ptr & system,
+    std::vector< unsigned long > & timestamps,
+    std::vector< bool > & flags,
+    const uint8_t *request,
+    size_t length,
     std::string & response);
 
-#endif
\ No newline at end of file
+#endif
@@ -24,23 +24,71 @@ System::ptr system_;
 int main(int argc, char *argv[])
 {
 
-    if (argc != 3)
+    if (argc < 3 || argc > 8)
     {
-        std::cout << "Usage:\t" << argv[0] << " <Serial> <I2C>" << std::endl;
+        std::cout << "Usage:\t" << argv[0] << " <Serial> <I2C> [capacity] [retention] [nodes] [journal] [threads]" << std::endl;
         std::cout << " e.g.:\t" << argv[0] << " /dev/tty/ACM0   /tmp/i2c" << std::endl;
-           
+        std::cout << "\t" << argv[0] << " /dev/tty/ACM0   /tmp/i2c 36000 3600" << std::endl;
+        std::cout << "\t" << argv[0] << " /dev/tty/ACM0   /tmp/i2c 36000 3600 64" << std::endl;
+        std::cout << "\t" << argv[0] << " /dev/tty/ACM0   /tmp/i2c 36000 3600 64 /var/log/journal.bin" << std::endl;
+        std::cout << "\t" << argv[0] << " /dev/tty/ACM0   /tmp/i2c 36000 3600 64 /var/log/journal.bin 4" << std::endl;
+        std::cout << "capacity:  maximum log entries per node (default "
+            << HISTORY_CAPACITY << ")" << std::endl;
+        std::cout << "retention: maximum log entry age in seconds, 0 for none (default "
+            << HISTORY_RETENTION << ")" << std::endl;
+        std::cout << "nodes:     number of nodes in the system (default "
+            << NODES << ")" << std::endl;
+        std::cout << "journal:   file every sample is appended to (default "
+            << JOURNAL_PATH << "), the previous session kept in <journal>"
+            << JOURNAL_PREVIOUS << std::endl;
+        std::cout << "threads:   threads serving TCP sessions (default "
+            << TCP_THREADS << ")" << std::endl;
+
         exit(EXIT_FAILURE);
     }
 
-    system_ = System::ptr(new System(NODES, T_S, argv[1], argv[2]));
+    size_t capacity = HISTORY_CAPACITY;
+    unsigned long retention = HISTORY_RETENTION;
+    size_t nodes = NODES;
+    std::string journal = JOURNAL_PATH;
+    size_t threads = TCP_THREADS;
+    try
+    {
+        if (argc > 3) capacity = std::stoul(argv[3]);
+        if (argc > 4) retention = std::stoul(argv[4]);
+        if (argc > 5) nodes = std::stoul(argv[5]);
+        if (argc > 6) journal = argv[6];
+        if (argc > 7) threads = std::stoul(argv[7]);
+        if (nodes == 0) throw std::invalid_argument("no nodes");
+        // Every node must be addressable by the binary protocol
+        if (nodes >= BINARY_TOTAL) throw std::invalid_argument("too many nodes");
+        if (threads == 0) throw std::invalid_argument("no TCP threads");
+    }
+    catch (std::exception & e)
+    {
+        errPrintTrace("Invalid configuration: " << e.what());
+        exit(EXIT_FAILURE);
+    }
+
+    system_ = System::ptr(new System(nodes, T_S, capacity, retention, argv[1], argv[2]));
+    if (!system_->openJournal(journal))
+    {
+        exit(EXIT_FAILURE);
+    }
     
     std::thread t1(i2c);
-    std::thread t2(tcpServer);
+    std::thread t2(tcpServer, threads);
     std::thread t3(serial);
+    std::thread t4(commit);
+    std::thread t5(journalSync);
+    std::thread t6(exportWorker);
 
     t1.join();
     t2.join();
     t3.join();
+    t4.join();
+    t5.join();
+    t6.join();
 
     return 0;
 }
@@ -55,13 +103,39 @@ void serial()
     system_->runSerial();
 }
 
-void tcpServer()
+void commit()
+{
+    system_->runCommit();
+}
+
+void journalSync()
+{
+    system_->runJournal();
+}
+
+void exportWorker()
+{
+    system_->runExport();
+}
+
+void tcpServer(size_t threads)
 {
     try
     {
         boost::asio::io_service io;
         TCPServer server(io, PORT, system_);
+
+        // Sessions are spread over the pool, each serialised by its strand
+        std::vector< std::thread > pool;
+        for (size_t i = 1; i < threads; i++)
+        {
+            pool.push_back(std::thread([&io](){ io.run(); }));
+        }
         io.run();
+        for (std::thread & t : pool)
+        {
+            t.join();
+        }
     }
     catch (std::exception & e)
     {
@@ -13,14 +13,17 @@
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <thread>
+#include <vector>
 
 #include "System.hpp"
 #include "TCPServer.hpp"
 
 /**
  * @brief      Runs the TCP server application.
+ *
+ * @param[in]  threads  The number of threads serving sessions
  */
-void tcpServer();
+void tcpServer(size_t threads);
 
 /**
  * @brief      Runs the System's I2C packet listener service.
@@ -32,4 +35,19 @@ void i2c();
  */
 void serial();
 
+/**
+ * @brief      Runs the System's ingest commit stage.
+ */
+void commit();
+
+/**
+ * @brief      Runs the System's periodic journal sync.
+ */
+void journalSync();
+
+/**
+ * @brief      Runs the System's background exports.
+ */
+void exportWorker();
+
 #endif
\ No newline at end of file
@@ -66,7 +66,8 @@ int main(int argc, char** argv) {
     boost::system::error_code error;
     for (auto i : script){
         
-        asio::write( socket, asio::buffer(i.command), error );
+        // Commands are newline-terminated
+        asio::write( socket, asio::buffer(i.command + "\n"), error );
 
         if( error ) {
             std::cout << "Send failed: " << error.message() << std::endl;